@@ -0,0 +1,327 @@
+#include <benchmark/benchmark.h>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <qoi15.hpp>
+#include <qoi15synthetic.hpp>
+#include <opencv2/opencv.hpp>
+
+//16bit mono frame with its name in the report
+struct Input
+{
+    std::string name;
+    std::vector<uint16_t> pixels;
+    size_t width;
+    size_t height;
+};
+
+//searches relPath from the working directory up, empty if it is nowhere
+static std::string resolvePath(const std::string &relPath)
+{
+    auto baseDir = std::filesystem::current_path();
+    while (true)
+    {
+        auto combinePath = baseDir / relPath;
+        if (std::filesystem::exists(combinePath))
+        {
+            return combinePath.string();
+        }
+        //the root is its own parent
+        if (baseDir == baseDir.parent_path())
+        {
+            return std::string();
+        }
+        baseDir = baseDir.parent_path();
+    }
+}
+
+//same 24bit color to 16bit mono conversion as the tests
+static Input loadImage(const std::string &name, const std::string &path)
+{
+    cv::Mat image = cv::imread(path);
+    std::vector<uint16_t> mono(static_cast<size_t>(image.cols) * image.rows);
+    for (auto y = 0; y < image.rows; y++)
+    {
+        for (auto x = 0; x < image.cols; x++)
+        {
+            auto c = 0.0;
+            c += image.data[y * image.step + x * image.elemSize() + 0];
+            c += image.data[y * image.step + x * image.elemSize() + 1];
+            c += image.data[y * image.step + x * image.elemSize() + 2];
+            mono[y * image.cols + x] = static_cast<uint16_t>(c / (255 * 3) * 65535);
+        }
+    }
+    return {name, std::move(mono), static_cast<size_t>(image.cols), static_cast<size_t>(image.rows)};
+}
+
+//sizes are the sides of the square frames of each qoi15::SyntheticKind
+static std::vector<Input> makeInputs(const std::vector<int> &sizes)
+{
+    std::vector<Input> inputs;
+    for (auto i = 1; i <= 7; i++)
+    {
+        auto name = "cat" + std::to_string(i);
+        auto path = resolvePath("Tests/Images/" + name + ".jpg");
+        if (!path.empty())
+        {
+            inputs.push_back(loadImage(name, path));
+        }
+    }
+
+    //synthetic frames of 1920x1080, the same every run
+    constexpr int width = 1920;
+    constexpr int height = 1080;
+    std::vector<uint16_t> flat(width * height, 0x4000);
+    std::vector<uint16_t> gradient(width * height);
+    std::vector<uint16_t> noisy(width * height);
+    std::vector<uint16_t> sparse(width * height, 0x1000);
+    uint32_t seed = 1;
+    for (auto i = 0; i < width * height; i++)
+    {
+        auto x = i % width;
+        auto y = i / width;
+        seed = seed * 1664525 + 1013904223;
+        gradient[i] = static_cast<uint16_t>(x * 16 + y * 8);
+        noisy[i] = static_cast<uint16_t>(seed >> 16);
+        if ((seed >> 24) == 0)
+        {
+            sparse[i] = static_cast<uint16_t>(seed >> 8);
+        }
+    }
+    inputs.push_back({"flat", std::move(flat), width, height});
+    inputs.push_back({"gradient", std::move(gradient), width, height});
+    inputs.push_back({"noisy", std::move(noisy), width, height});
+    inputs.push_back({"sparse", std::move(sparse), width, height});
+
+    for (auto size : sizes)
+    {
+        for (auto kind : qoi15::GetSyntheticKinds())
+        {
+            auto name = std::string(qoi15::GetSyntheticName(kind)) + std::to_string(size);
+            inputs.push_back({name, qoi15::SyntheticImage(kind, size, size).Generate(), static_cast<size_t>(size), static_cast<size_t>(size)});
+        }
+    }
+    return inputs;
+}
+
+//MB/s of 16bit pixels and pixels/s
+static void setThroughput(benchmark::State &state, const size_t pixels)
+{
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * pixels * sizeof(uint16_t)));
+    state.counters["pixels"] = benchmark::Counter(static_cast<double>(state.iterations() * pixels), benchmark::Counter::kIsRate);
+}
+
+template <int shift>
+static void encode(benchmark::State &state, const Input *input)
+{
+    qoi15::QOI15Encoder<shift> encoder;
+    std::vector<uint16_t> out(qoi15::MaxEncodedSize(input->pixels.size()));
+    for (auto _ : state)
+    {
+        encoder.Encode(input->pixels.data(), static_cast<int>(input->pixels.size()), out.data());
+        benchmark::DoNotOptimize(out.data());
+    }
+    setThroughput(state, input->pixels.size());
+    state.counters["words/pixel"] = static_cast<double>(std::get<1>(encoder.Get())) / input->pixels.size();
+}
+
+template <int shift>
+static void decode(benchmark::State &state, const Input *input)
+{
+    std::vector<uint16_t> encoded(qoi15::MaxEncodedSize(input->pixels.size()));
+    auto words = qoi15::EncodeInto<shift>(input->pixels.data(), input->pixels.size(), encoded.data(), encoded.size());
+
+    qoi15::QOI15Decoder<shift> decoder;
+    std::vector<uint16_t> out(input->pixels.size());
+    for (auto _ : state)
+    {
+        decoder.Decode(encoded.data(), static_cast<int>(words), out.data(), static_cast<int>(out.size()));
+        benchmark::DoNotOptimize(out.data());
+    }
+    setThroughput(state, input->pixels.size());
+}
+
+//the same with ToMedResidual() in front of the encoder and FromMedResidual() after the decoder
+template <int shift>
+static void encodeMed(benchmark::State &state, const Input *input)
+{
+    qoi15::QOI15Encoder<shift> encoder;
+    std::vector<uint16_t> residual(input->pixels.size());
+    std::vector<uint16_t> out(qoi15::MaxEncodedSize(input->pixels.size()));
+    for (auto _ : state)
+    {
+        qoi15::ToMedResidual(input->pixels.data(), residual.data(), input->width, input->height, shift);
+        encoder.Encode(residual.data(), static_cast<int>(residual.size()), out.data());
+        benchmark::DoNotOptimize(out.data());
+    }
+    setThroughput(state, input->pixels.size());
+    state.counters["words/pixel"] = static_cast<double>(std::get<1>(encoder.Get())) / input->pixels.size();
+}
+
+template <int shift>
+static void decodeMed(benchmark::State &state, const Input *input)
+{
+    std::vector<uint16_t> residual(input->pixels.size());
+    qoi15::ToMedResidual(input->pixels.data(), residual.data(), input->width, input->height, shift);
+    std::vector<uint16_t> encoded(qoi15::MaxEncodedSize(input->pixels.size()));
+    auto words = qoi15::EncodeInto<shift>(residual.data(), residual.size(), encoded.data(), encoded.size());
+
+    qoi15::QOI15Decoder<shift> decoder;
+    std::vector<uint16_t> out(input->pixels.size());
+    for (auto _ : state)
+    {
+        decoder.Decode(encoded.data(), static_cast<int>(words), out.data(), static_cast<int>(out.size()));
+        qoi15::FromMedResidual(out.data(), out.data(), input->width, input->height, shift);
+        benchmark::DoNotOptimize(out.data());
+    }
+    setThroughput(state, input->pixels.size());
+}
+
+//token classes of the default layout, each on 4096 values per iteration
+using Config = qoi15::CodecConfig<>;
+constexpr int TokenCount = 4096;
+
+static void runLength(benchmark::State &state)
+{
+    Config::RunLengthType runLength;
+    uint8_t values[Config::RunLengthType::MaxCount];
+    for (auto _ : state)
+    {
+        for (auto length = 1; length <= TokenCount; length++)
+        {
+            auto count = runLength.Get(length, values);
+            benchmark::DoNotOptimize(runLength.Set(values, count));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * TokenCount);
+}
+BENCHMARK(runLength);
+
+static void differential(benchmark::State &state)
+{
+    Config::DifferentialType differential;
+    for (auto _ : state)
+    {
+        uint16_t previous = 0x1000;
+        for (auto i = 0; i < TokenCount; i++)
+        {
+            auto current = static_cast<uint16_t>(0x1000 + (i * 7) % 13);
+            auto diff = differential.Sub(previous, current);
+            if (differential.IsValid(diff))
+            {
+                previous = differential.Add(previous, differential.Set(differential.Get(diff)));
+            }
+            else
+            {
+                previous = current;
+            }
+        }
+        benchmark::DoNotOptimize(previous);
+    }
+    state.SetItemsProcessed(state.iterations() * TokenCount);
+}
+BENCHMARK(differential);
+
+static void table(benchmark::State &state)
+{
+    Config::TableType table;
+    for (auto _ : state)
+    {
+        table.Reset();
+        auto hits = 0;
+        for (auto i = 0; i < TokenCount; i++)
+        {
+            auto current = static_cast<uint16_t>((i * 2654435761u) >> 27);
+            auto hash = table.Hash(current);
+            if (table.Refer(hash) == current)
+            {
+                benchmark::DoNotOptimize(table.Get(hash));
+                hits++;
+            }
+            else
+            {
+                table.Insert(hash, current);
+            }
+        }
+        benchmark::DoNotOptimize(hits);
+    }
+    state.SetItemsProcessed(state.iterations() * TokenCount);
+}
+BENCHMARK(table);
+
+static void chunker(benchmark::State &state)
+{
+    qoi15::Chunker chunker;
+    for (auto _ : state)
+    {
+        uint16_t sum = 0;
+        for (auto i = 0; i < TokenCount; i++)
+        {
+            uint8_t first, second, third;
+            chunker.Get(static_cast<uint16_t>(i * 8), first, second, third);
+            sum += chunker.Set(first, second, third);
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * TokenCount);
+}
+BENCHMARK(chunker);
+
+//JSON unless --benchmark_format says otherwise, so that runs of different versions can be compared,
+//--synthetic_sizes=256,16384 replaces the default 1024x1024 synthetic frames
+int main(int argc, char **argv)
+{
+    std::vector<int> sizes{1024};
+    std::vector<char *> args;
+    for (auto i = 0; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        std::string prefix("--synthetic_sizes=");
+        if (arg.rfind(prefix, 0) != 0)
+        {
+            args.push_back(argv[i]);
+            continue;
+        }
+        sizes.clear();
+        for (size_t begin = prefix.size(); begin < arg.size();)
+        {
+            auto end = std::min(arg.find(',', begin), arg.size());
+            sizes.push_back(std::stoi(arg.substr(begin, end - begin)));
+            begin = end + 1;
+        }
+    }
+
+    static const auto inputs = makeInputs(sizes);
+    for (const auto &input : inputs)
+    {
+        benchmark::RegisterBenchmark(("encode/shift1/" + input.name).c_str(), encode<1>, &input);
+        benchmark::RegisterBenchmark(("encode/shift6/" + input.name).c_str(), encode<6>, &input);
+        benchmark::RegisterBenchmark(("decode/shift1/" + input.name).c_str(), decode<1>, &input);
+        benchmark::RegisterBenchmark(("decode/shift6/" + input.name).c_str(), decode<6>, &input);
+        benchmark::RegisterBenchmark(("encode/med/shift1/" + input.name).c_str(), encodeMed<1>, &input);
+        benchmark::RegisterBenchmark(("encode/med/shift6/" + input.name).c_str(), encodeMed<6>, &input);
+        benchmark::RegisterBenchmark(("decode/med/shift1/" + input.name).c_str(), decodeMed<1>, &input);
+        benchmark::RegisterBenchmark(("decode/med/shift6/" + input.name).c_str(), decodeMed<6>, &input);
+    }
+
+    std::string format = "--benchmark_format=json";
+    auto hasFormat = false;
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        hasFormat = hasFormat || std::string(args[i]).rfind("--benchmark_format", 0) == 0;
+    }
+    if (!hasFormat)
+    {
+        args.push_back(&format[0]);
+    }
+    auto count = static_cast<int>(args.size());
+    benchmark::Initialize(&count, args.data());
+    if (benchmark::ReportUnrecognizedArguments(count, args.data()))
+    {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
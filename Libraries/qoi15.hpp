@@ -22,27 +22,198 @@
 
 #include <iostream>
 #include <vector>
-#include <list>
+#include <array>
 #include <tuple>
+#include <stdexcept>
+#include <limits>
+#include <exception>
+#include <utility>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <string>
+
+#if !defined(DISABLE_SIMD) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#define QOI15_X86
+#include <immintrin.h>
+#endif
+
+//pext and pdep work on 64bit registers
+#if defined(QOI15_X86) && (defined(__x86_64__) || defined(_M_X64))
+#define QOI15_BMI2
+#endif
+
+//memory mapped files need POSIX and a byte order that matches the file
+#if (defined(__unix__) || defined(__APPLE__)) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define QOI15_MMAP
+#include <cerrno>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define QOI15_TARGET(name)
+#else
+#define QOI15_TARGET(name) __attribute__((target(name)))
+#endif
 
 namespace qoi15
 {
+    enum class SimdLevel
+    {
+        Scalar,
+        SSE41,
+        AVX2,
+    };
+
+    //the best instruction set of the running CPU, detected once
+    inline SimdLevel DetectSimdLevel()
+    {
+        static const SimdLevel level = []()
+        {
+#if defined(QOI15_X86) && defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 0);
+            auto maxId = info[0];
+            __cpuid(info, 1);
+            auto sse41 = (info[2] & (1 << 19)) != 0;
+            auto osAvx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+            auto avx2 = false;
+            if (maxId >= 7)
+            {
+                __cpuidex(info, 7, 0);
+                avx2 = osAvx && (info[1] & (1 << 5)) != 0;
+            }
+            return avx2 ? SimdLevel::AVX2 : (sse41 ? SimdLevel::SSE41 : SimdLevel::Scalar);
+#elif defined(QOI15_X86)
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+            {
+                return SimdLevel::AVX2;
+            }
+            if (__builtin_cpu_supports("sse4.1"))
+            {
+                return SimdLevel::SSE41;
+            }
+            return SimdLevel::Scalar;
+#else
+            return SimdLevel::Scalar;
+#endif
+        }();
+        return level;
+    }
+
+    //SSE4.2 crc32 instruction, detected once
+    inline bool DetectCrc32()
+    {
+        static const bool supported = []()
+        {
+#if defined(QOI15_X86) && defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 1);
+            return (info[2] & (1 << 20)) != 0;
+#elif defined(QOI15_X86)
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse4.2") != 0;
+#else
+            return false;
+#endif
+        }();
+        return supported;
+    }
+
+    //BMI2 pext and pdep, detected once, only used by 64bit builds
+    inline bool DetectBmi2()
+    {
+        static const bool supported = []()
+        {
+#if defined(QOI15_X86) && defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] < 7)
+            {
+                return false;
+            }
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 8)) != 0;
+#elif defined(QOI15_X86)
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("bmi2") != 0;
+#else
+            return false;
+#endif
+        }();
+        return supported;
+    }
+
+    //value must not be 0
+    inline int CountTrailingZeros(const uint32_t value)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, value);
+        return static_cast<int>(index);
+#else
+        return __builtin_ctz(value);
+#endif
+    }
+
+    //value must not be 0
+    inline int CountLeadingZeros(const uint32_t value)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanReverse(&index, value);
+        return 31 - static_cast<int>(index);
+#else
+        return __builtin_clz(value);
+#endif
+    }
+
+    //shift of the low 15bit stream inside EncodeInto/DecodeInto<LosslessShift>, which the public codecs never take,
+    //as they would silently drop the MSB
+    constexpr int LowStreamShift = -1;
+
     template <int shift>
     class BitShifter
     {
-    public:
-        BitShifter()
-        {
-            static_assert(shift > 0, "must be larger than 0");
-        }
+        static_assert(shift > 0 || shift == LowStreamShift, "must be larger than 0");
 
+    public:
+        //the low stream keeps the low 15bit, the MSB travels in a side stream
         uint16_t Get(const uint16_t value)
         {
-            return value >> shift;
+            if constexpr (shift == LowStreamShift)
+            {
+                return value & 0x7FFF;
+            }
+            else
+            {
+                return value >> shift;
+            }
         }
         uint16_t Set(const uint16_t value)
         {
-            return value << shift;
+            if constexpr (shift == LowStreamShift)
+            {
+                return value;
+            }
+            else
+            {
+                return value << shift;
+            }
         }
     };
 
@@ -50,6 +221,10 @@ namespace qoi15
     class RunLength
     {
     public:
+        static constexpr int ValueBit = valueBit;
+        //enough chunks for any positive int length
+        static constexpr int MaxCount = (sizeof(int) * 8 + valueBit - 1) / valueBit;
+
         RunLength()
         {
             //2bit: header 0b00
@@ -61,25 +236,25 @@ namespace qoi15
             return (value & (~mask)) == header;
         }
 
-        std::list<uint8_t> Get(int length)
+        //values must hold MaxCount elements, returns the number of chunks
+        int Get(int length, uint8_t *values)
         {
-            std::list<uint8_t> values;
+            auto count = 0;
             while (length != 0)
             {
-                auto value = static_cast<uint8_t>(length & mask) | header;
-                values.emplace_back(value);
+                values[count++] = static_cast<uint8_t>(length & mask) | header;
                 length = length >> valueBit;
             }
-            return values;
+            return count;
         }
 
-        int Set(const std::list<uint8_t> &values)
+        int Set(const uint8_t *values, const int count)
         {
             int length = 0;
             auto shift = 0;
-            for (const auto &value : values)
+            for (auto i = 0; i < count; ++i)
             {
-                length |= (value & mask) << shift;
+                length |= (values[i] & mask) << shift;
                 shift += valueBit;
             }
 
@@ -93,6 +268,9 @@ namespace qoi15
         const int32_t MaxValue;
 
     public:
+        static constexpr int32_t MaxDiff = 1 << (valueBit - 1);
+        static constexpr uint8_t Header = header;
+
         Differential()
             : MaxValue(1 << (valueBit - 1))
         {
@@ -136,14 +314,22 @@ namespace qoi15
     template <int headerBit, int valueBit, uint8_t header, uint8_t mask>
     class Table
     {
-        const int32_t TableSize;
-        std::vector<uint16_t> ref_;
+        static constexpr int32_t TableSize = 1 << valueBit;
+        std::array<uint16_t, TableSize> ref_;
         const int32_t hashBit_;
 
     public:
+        static constexpr int32_t Size = TableSize;
+
         Table(const int hashBit = 1)
-            : TableSize(1 << valueBit), ref_(TableSize, 0xFFFF), hashBit_(hashBit)
+            : hashBit_(hashBit)
+        {
+            Reset();
+        }
+
+        void Reset()
         {
+            ref_.fill(0xFFFF);
         }
 
         bool CheckHeader(const uint8_t value)
@@ -172,6 +358,16 @@ namespace qoi15
             ref_[hash] = value;
         }
 
+        void Store(uint16_t *entries) const
+        {
+            std::copy(ref_.begin(), ref_.end(), entries);
+        }
+
+        void Load(const uint16_t *entries)
+        {
+            std::copy(entries, entries + TableSize, ref_.begin());
+        }
+
         uint8_t Get(const uint8_t hash)
         {
             return header | hash;
@@ -219,321 +415,3649 @@ namespace qoi15
         }
     };
 
-    class Repository
+    template <class RunLengthType, class DifferentialType, class TableType, class CopyLengthType = void>
+    class WordTable
     {
-    protected:
-        Chunker chunker_;
+        //one action byte per 5bit value: kind in the upper 2bit, operand in the lower 6bit
+        std::array<uint32_t, 0x8000> actions_;
+
+        WordTable()
+        {
+            Chunker chunker;
+            uint8_t values[3];
+            for (uint32_t word = 0; word < 0x8000; ++word)
+            {
+                chunker.Get(static_cast<uint16_t>(word), values[0], values[1], values[2]);
+
+                uint32_t actions = 0;
+                auto diffs = 0;
+                for (auto i = 0; i < 3; ++i)
+                {
+                    auto action = Decode(values[i]);
+                    actions |= static_cast<uint32_t>(action) << (i * 8);
+                    diffs += (action & KindMask) == DiffAction ? 1 : 0;
+                }
+                if (diffs == 3)
+                {
+                    actions |= AllDiffFlag;
+                }
+                actions_[word] = actions;
+            }
+        }
+
+        static uint8_t Decode(const uint8_t value)
+        {
+            RunLengthType runLength;
+            DifferentialType differential;
+            TableType table;
+
+            if (runLength.CheckHeader(value))
+            {
+                return RunAction | (value & 0x3F);
+            }
+            if (differential.CheckHeader(value))
+            {
+                return DiffAction | static_cast<uint8_t>(differential.Set(value) + DiffBias);
+            }
+            if constexpr (!std::is_void<CopyLengthType>::value)
+            {
+                CopyLengthType copyLength;
+                if (copyLength.CheckHeader(value))
+                {
+                    return CopyAction | static_cast<uint8_t>(copyLength.Set(&value, 1));
+                }
+            }
+            return TableAction | table.Set(value);
+        }
 
     public:
-        virtual void Set(const uint16_t value) = 0;
-        virtual void Set(const uint8_t value) = 0;
-        virtual void Flush() = 0;
+        static constexpr uint8_t RunAction = 0x00;
+        static constexpr uint8_t DiffAction = 0x40;
+        static constexpr uint8_t TableAction = 0x80;
+        static constexpr uint8_t CopyAction = 0xC0;
+        static constexpr uint8_t KindMask = 0xC0;
+        static constexpr uint8_t OperandMask = 0x3F;
+        static constexpr int32_t DiffBias = 32;
+        //set in the 4th byte when all 3 values are diffs
+        static constexpr uint32_t AllDiffFlag = 0x01000000;
+
+        WordTable(const WordTable &) = delete;
+
+        //shared by every decoder, built on first use
+        static const WordTable &Instance()
+        {
+            static const WordTable instance;
+            return instance;
+        }
+
+        //3 action bytes, the first value in the lowest byte, and flags
+        uint32_t Get(const uint16_t word) const
+        {
+            return actions_[word & 0x7FFF];
+        }
     };
 
-    class SpeedFirstRepository : public Repository
+#ifdef QOI15_X86
+    QOI15_TARGET("avx2")
+    inline void FillWordsAVX2(uint16_t *out, const uint16_t value, int count)
     {
-        std::vector<uint16_t> buffer_;
-        int counter_;
+        auto wide = _mm256_set1_epi16(static_cast<short>(value));
+        for (; count >= 16; count -= 16, out += 16)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), wide);
+        }
+        for (; count > 0; --count)
+        {
+            *out++ = value;
+        }
+    }
+#endif
+
+    //run expansion, long runs are written with 256bit stores
+    inline void FillWords(uint16_t *out, const uint16_t value, const int count)
+    {
+#ifdef QOI15_X86
+        static const auto avx2 = DetectSimdLevel() == SimdLevel::AVX2;
+        if (count >= 32 && avx2)
+        {
+            FillWordsAVX2(out, value, count);
+            return;
+        }
+#endif
+        for (auto i = 0; i < count; ++i)
+        {
+            out[i] = value;
+        }
+    }
+
+    //packs 5bit values into 15bit words and hands every finished word to Derived::Write(uint16_t)
+    template <class Derived>
+    class Repository
+    {
+    protected:
+        Chunker chunker_;
 
-        std::list<uint8_t> temp_;
+        //5bit values waiting to be packed into the next 15bit word
+        uint8_t temp_[3];
         int tempCounter_;
 
+        Repository()
+            : temp_{0}, tempCounter_(0)
+        {
+        }
+
     public:
-        SpeedFirstRepository(const int maxSize)
-            : buffer_(maxSize), counter_(0), temp_(), tempCounter_(0)
+        //drops staged values, sinks extend it to rewind their output
+        void Reset()
+        {
+            tempCounter_ = 0;
+        }
+
+        //values already staged for the word being packed
+        int GetPending() const
+        {
+            return tempCounter_;
+        }
+
+        //called with the worst-case word count before a frame, sinks may preallocate
+        void Reserve(const int)
         {
         }
 
-        virtual void Set(const uint16_t value)
+        void Set(const uint16_t value)
         {
             if (tempCounter_ > 0)
             {
                 Flush();
             }
 
-            buffer_[counter_++] = value;
+            static_cast<Derived *>(this)->Write(value);
         }
 
-        virtual void Set(const uint8_t value)
+        void Set(const uint8_t value)
         {
-            temp_.emplace_back(value);
-            tempCounter_++;
+            temp_[tempCounter_++] = value;
+            if (tempCounter_ == 3)
+            {
+                static_cast<Derived *>(this)->Write(chunker_.Set(temp_[0], temp_[1], temp_[2]));
+                tempCounter_ = 0;
+            }
         }
 
-        virtual void Flush()
+        //decoders write runs through this, sinks may replace it with a bulk fill
+        void Fill(const uint16_t value, const int count)
         {
-            auto ite = temp_.begin();
-            while (tempCounter_ >= 3)
+            for (auto i = 0; i < count; ++i)
             {
-                auto first = *ite;
-                ite++;
-                auto second = *ite;
-                ite++;
-                auto third = *ite;
-                ite++;
-                auto value = chunker_.Set(first, second, third);
-                buffer_[counter_++] = value;
+                static_cast<Derived *>(this)->Write(value);
+            }
+        }
 
-                tempCounter_ -= 3;
+        //same as setting the values one by one
+        void Set(const uint8_t *values, int count)
+        {
+            while (count > 0 && tempCounter_ != 0)
+            {
+                Set(*values++);
+                count--;
+            }
+            for (; count >= 3; count -= 3, values += 3)
+            {
+                static_cast<Derived *>(this)->Write(chunker_.Set(values[0], values[1], values[2]));
+            }
+            while (count-- > 0)
+            {
+                Set(*values++);
             }
+        }
+
+        void Flush()
+        {
             if (tempCounter_ > 0)
             {
-                uint8_t fst[3] = {0};
-                for (auto i = 0; i < tempCounter_; ++i)
+                //pad the unused values with 0
+                for (auto i = tempCounter_; i < 3; ++i)
                 {
-                    fst[i] = *ite;
-                    ite++;
+                    temp_[i] = 0;
                 }
                 tempCounter_ = 0;
-                auto value = chunker_.Set(fst[0], fst[1], fst[2]);
-                buffer_[counter_++] = value;
+                static_cast<Derived *>(this)->Write(chunker_.Set(temp_[0], temp_[1], temp_[2]));
             }
-            temp_.clear();
         }
+    };
 
-        int GetSize()
+    class SpeedFirstRepository : public Repository<SpeedFirstRepository>
+    {
+        std::vector<uint16_t> storage_;
+        uint16_t *buffer_;
+        int counter_;
+
+    public:
+        SpeedFirstRepository(const int maxSize = 0)
+            : storage_(maxSize), buffer_(storage_.data()), counter_(0)
         {
-            return counter_;
         }
 
-        std::vector<uint16_t>::const_iterator GetIterator()
+        //writes into memory owned by the caller
+        SpeedFirstRepository(uint16_t *buffer)
+            : storage_(), buffer_(buffer), counter_(0)
         {
-            return buffer_.begin();
         }
-    };
-
-    template<int internalShift=1>
-    class QOI15Encoder
-    {
-        BitShifter<internalShift> bitShifter_;
-        RunLength<2, 3, 0x00, 0x07> runLength_;
-#ifndef TABLE_FIRST
-        Differential<1, 4, 0x10, 0x0F> differential_;
-        Table<2, 3, 0x08, 0x07> table_;
-#else
-        Differential<2, 3, 0x08, 0x07> differential_;
-        Table<1, 4, 0x10, 0x0F> table_;
-#endif
-        Raw15bit raw_;
-
-        SpeedFirstRepository repository_;
-
-#ifdef ENABLE_STATICS
-        int runLengthCount_;
-        int diffCount_;
-        int tableCount_;
-        int rawCount_;
-#endif
 
-    public:
-        QOI15Encoder(const uint16_t *buffer, const int size)
-            : repository_(size)
-#ifdef ENABLE_STATICS
-            , runLengthCount_(0), diffCount_(0), tableCount_(0), rawCount_(0)
-#endif
+        //rewinds to the beginning of the current buffer
+        void Reset()
         {
-            uint16_t previous = 0xFFFF;
-            auto runLength = 0;
+            Repository::Reset();
+            counter_ = 0;
+        }
 
-            for (auto i = 0; i < size; ++i)
+        //switches to the owned storage, which only ever grows
+        void Reserve(const int maxSize)
+        {
+            if (static_cast<int>(storage_.size()) < maxSize)
             {
-                auto current = bitShifter_.Get(buffer[i]);
+                storage_.resize(maxSize);
+            }
+            buffer_ = storage_.data();
+        }
 
-                if (previous == current)
-                {
-                    runLength++;
-                    continue;
-                }
-                if (runLength != 0)
-                {
-                    //flush
-                    auto runValues = runLength_.Get(runLength);
-                    for (auto &runValue : runValues)
-                    {
-                        repository_.Set(runValue);
-                    }
-#ifdef ENABLE_STATICS
-                    runLengthCount_ += runLength;
-#endif
-                    runLength = 0;
-                }
+        //switches to memory owned by the caller
+        void Attach(uint16_t *buffer)
+        {
+            buffer_ = buffer;
+        }
 
-                auto diff = differential_.Sub(previous, current);
-                if (differential_.IsValid(diff))
-                {
-                    auto value = differential_.Get(diff);
-                    repository_.Set(value);
-                    previous = current;
-#ifdef ENABLE_STATICS
-                    diffCount_++;
-#endif
-                    continue;
-                }
+        void Write(const uint16_t value)
+        {
+            buffer_[counter_++] = value;
+        }
 
-                auto hash = table_.Hash(current);
-                if (table_.Refer(hash) == current)
-                {
-                    auto value = table_.Get(hash);
-                    repository_.Set(value);
-                    previous = current;
-#ifdef ENABLE_STATICS
-                    tableCount_++;
-#endif
-                    continue;
-                }
-                table_.Insert(hash, current);
+        void Fill(const uint16_t value, const int count)
+        {
+            FillWords(buffer_ + counter_, value, count);
+            counter_ += count;
+        }
 
-                repository_.Set(raw_.Get(current));
-                previous = current;
-#ifdef ENABLE_STATICS
-                rawCount_++;
-#endif
-            }
-            if (runLength != 0)
+        //repeats the words distance back, count may exceed distance, returns the last word
+        uint16_t Copy(const int distance, int count)
+        {
+            while (count > 0)
             {
-                //flush
-                auto runValues = runLength_.Get(runLength);
-                for (auto &runValue : runValues)
-                {
-                    repository_.Set(runValue);
-                }
-#ifdef ENABLE_STATICS
-                    runLengthCount_ += runLength;
-#endif
-                runLength = 0;
+                auto chunk = std::min(count, distance);
+                std::memcpy(buffer_ + counter_, buffer_ + counter_ - distance, chunk * sizeof(uint16_t));
+                counter_ += chunk;
+                count -= chunk;
             }
-
-            repository_.Flush();
+            return buffer_[counter_ - 1];
         }
 
-        std::tuple<std::vector<uint16_t>::const_iterator, int> Get()
+        int GetSize()
         {
-            return {repository_.GetIterator(), repository_.GetSize()};
+            return counter_;
         }
 
-#ifdef ENABLE_STATICS
-        void ShowStatics()
+        const uint16_t *GetIterator()
         {
-            std::cout << "runLength: " << runLengthCount_ << std::endl;
-            std::cout << "diff: " << diffCount_ << std::endl;
-            std::cout << "table: " << tableCount_ << std::endl;
-            std::cout << "raw: " << rawCount_ << std::endl;
+            return buffer_;
         }
-#endif        
     };
 
-    class QOI15Decoder
+    //only counts words, for size estimation
+    class CountingRepository : public Repository<CountingRepository>
     {
-        BitShifter<1> bitShifter_;
-        RunLength<2, 3, 0x00, 0x07> runLength_;
-#ifndef TABLE_FIRST
-        Differential<1, 4, 0x10, 0x0F> differential_;
-        Table<2, 3, 0x08, 0x07> table_;
-#else
-        Differential<2, 3, 0x08, 0x07> differential_;
-        Table<1, 4, 0x10, 0x0F> table_;
-#endif
-        Raw15bit raw_;
-
-        SpeedFirstRepository repository_;
+        int counter_;
 
     public:
-        Chunker chunker_;
-        QOI15Decoder(const uint16_t *buffer, const int size, const int outputSize)
-            : repository_(outputSize)
+        CountingRepository()
+            : counter_(0)
         {
-            auto counter = 0;
-            uint16_t previous = 0xFFFF;
-            std::list<uint8_t> leftovers;
-
-            std::list<uint8_t> runLengthValues;
+        }
 
-            while (counter < size || leftovers.size() > 0)
-            {
-                if (leftovers.size() > 0)
-                {
-                    auto value = leftovers.front();
-                    leftovers.pop_front();
+        void Reset()
+        {
+            Repository::Reset();
+            counter_ = 0;
+        }
 
-                    if (runLength_.CheckHeader(value))
-                    {
-                        runLengthValues.emplace_back(value);
-                    }
-                    else
-                    {
-                        if (runLengthValues.size() > 0)
-                        {
-                            auto length = runLength_.Set(runLengthValues);
-                            runLengthValues.clear();
-                            for (auto i = 0; i < length; ++i)
-                            {
-                                repository_.Set(bitShifter_.Set(previous));
-                            }
-                        }
-                    }
+        void Write(const uint16_t)
+        {
+            counter_++;
+        }
 
-                    if (differential_.CheckHeader(value))
-                    {
-                        auto diff = differential_.Set(value);
-                        auto current = differential_.Add(previous, diff);
-                        repository_.Set(bitShifter_.Set(current));
-                        previous = current;
-                    }
+        int GetSize()
+        {
+            return counter_;
+        }
+    };
 
-                    if (table_.CheckHeader(value))
-                    {
-                        auto hash = table_.Set(value);
-                        auto current = table_.Refer(hash);
-                        repository_.Set(bitShifter_.Set(current));
-                        previous = current;
-                    }
+    //collects words in a fixed buffer and hands them to a callback when it is full or on Emit()
+    class CallbackRepository : public Repository<CallbackRepository>
+    {
+    public:
+        using Sink = std::function<void(const uint16_t *, size_t)>;
 
-                    continue;
-                }
+    private:
+        Sink sink_;
+        std::vector<uint16_t> buffer_;
+        size_t counter_;
+        uint64_t emitted_;
 
-                auto value = buffer[counter++];
+    public:
+        explicit CallbackRepository(const int capacity = 4096)
+            : buffer_(capacity > 0 ? capacity : 1), counter_(0), emitted_(0)
+        {
+        }
 
-                if (raw_.IsValid(value))
-                {
-                    if (runLengthValues.size() > 0)
-                    {
-                        auto length = runLength_.Set(runLengthValues);
-                        runLengthValues.clear();
-                        for (auto i = 0; i < length; ++i)
-                        {
-                            repository_.Set(bitShifter_.Set(previous));
-                        }
-                    }
+        void SetSink(Sink sink)
+        {
+            sink_ = std::move(sink);
+        }
 
-                    auto current = raw_.Set(value);
-                    auto hash = table_.Hash(current);
-                    table_.Insert(hash, current);
-                    repository_.Set(bitShifter_.Set(current));
+        //drops words that were not emitted yet
+        void Reset()
+        {
+            Repository::Reset();
+            counter_ = 0;
+            emitted_ = 0;
+        }
+
+        void Write(const uint16_t value)
+        {
+            buffer_[counter_++] = value;
+            if (counter_ == buffer_.size())
+            {
+                Emit();
+            }
+        }
+
+        void Emit()
+        {
+            if (counter_ != 0)
+            {
+                if (sink_)
+                {
+                    sink_(buffer_.data(), counter_);
+                }
+                emitted_ += counter_;
+                counter_ = 0;
+            }
+        }
+
+        int GetSize()
+        {
+            return static_cast<int>(emitted_ + counter_);
+        }
+    };
+
+    //ors decoded pixels into memory owned by the caller, merges the MSB stream of a lossless stream
+    class MergeRepository : public Repository<MergeRepository>
+    {
+        uint16_t *buffer_;
+        int counter_;
+
+    public:
+        MergeRepository()
+            : buffer_(nullptr), counter_(0)
+        {
+        }
+
+        void Reset()
+        {
+            Repository::Reset();
+            counter_ = 0;
+        }
+
+        void Attach(uint16_t *buffer)
+        {
+            buffer_ = buffer;
+        }
+
+        void Write(const uint16_t value)
+        {
+            buffer_[counter_++] |= value;
+        }
+
+        //runs of 0 are most of an MSB stream and leave the buffer as it is
+        void Fill(const uint16_t value, const int count)
+        {
+            if (value != 0)
+            {
+                for (auto i = 0; i < count; ++i)
+                {
+                    buffer_[counter_ + i] |= value;
+                }
+            }
+            counter_ += count;
+        }
+
+        int GetSize()
+        {
+            return counter_;
+        }
+
+        const uint16_t *GetIterator()
+        {
+            return buffer_;
+        }
+    };
+
+    //which 5bit headers the differential, the table and the row copy own
+    enum class Layout : uint8_t
+    {
+        DiffFirst = 0,
+        TableFirst = 1,
+        //4 table entries give their headers to "copy N pixels from the row above"
+        RowCopy = 2,
+    };
+
+#ifndef TABLE_FIRST
+    constexpr Layout DefaultLayout = Layout::DiffFirst;
+#else
+    constexpr Layout DefaultLayout = Layout::TableFirst;
+#endif
+
+    template <Layout layout>
+    struct TokenTypes;
+
+    //run 00xxx, table 01xxx, diff 1xxxx
+    template <>
+    struct TokenTypes<Layout::DiffFirst>
+    {
+        using DifferentialType = Differential<1, 4, 0x10, 0x0F>;
+        using TableType = Table<2, 3, 0x08, 0x07>;
+        using CopyLengthType = void;
+    };
+
+    //run 00xxx, diff 01xxx, table 1xxxx
+    template <>
+    struct TokenTypes<Layout::TableFirst>
+    {
+        using DifferentialType = Differential<2, 3, 0x08, 0x07>;
+        using TableType = Table<1, 4, 0x10, 0x0F>;
+        using CopyLengthType = void;
+    };
+
+    //run 00xxx, copy 010xx, table 011xx, diff 1xxxx
+    template <>
+    struct TokenTypes<Layout::RowCopy>
+    {
+        using DifferentialType = Differential<1, 4, 0x10, 0x0F>;
+        using TableType = Table<3, 2, 0x0C, 0x03>;
+        using CopyLengthType = RunLength<3, 2, 0x08, 0x03>;
+    };
+
+    //token layout and precision shared by the encoder and the decoder of one stream
+    template <int internalShift = 1, Layout layout = DefaultLayout>
+    struct CodecConfig
+    {
+        static constexpr int Shift = internalShift;
+        static constexpr Layout TokenLayout = layout;
+        static constexpr bool HasCopy = layout == Layout::RowCopy;
+
+        using BitShifterType = BitShifter<internalShift>;
+        using RunLengthType = RunLength<2, 3, 0x00, 0x07>;
+        using DifferentialType = typename TokenTypes<layout>::DifferentialType;
+        using TableType = typename TokenTypes<layout>::TableType;
+        using CopyLengthType = typename TokenTypes<layout>::CopyLengthType;
+        using RawType = Raw15bit;
+        using WordTableType = WordTable<RunLengthType, DifferentialType, TableType, CopyLengthType>;
+    };
+
+    //the largest shift that still leaves one bit of the pixel
+    constexpr int MaxShift = 15;
+
+    //keeps all 16bit: the low 15bit as a regular stream, the MSBs as a shift 15 stream of the same pixels
+    constexpr int LosslessShift = 0;
+
+    //every pixel produces at most one word: a raw value, or a 5bit value padded into its own word
+    inline size_t MaxEncodedSize(const size_t pixels)
+    {
+        return pixels;
+    }
+
+    //the MSB stream of a lossless stream has one raw word at most, then one 5bit value per pixel, plus a 2 word trailer
+    inline size_t MaxEncodedSize(const size_t pixels, const int internalShift)
+    {
+        return internalShift == LosslessShift ? pixels + pixels / 3 + 4 : MaxEncodedSize(pixels);
+    }
+
+    //codec state in front of a token, decoding can start there instead of at word 0
+    struct RestartPoint
+    {
+        static constexpr int MaxTableSize = 16;
+
+        uint64_t wordOffset = 0;
+        uint64_t pixelOffset = 0;
+        //values of the word at wordOffset that belong to earlier pixels
+        uint8_t valueIndex = 0;
+        uint16_t previous = 0xFFFF;
+        std::array<uint16_t, MaxTableSize> table;
+
+        RestartPoint()
+        {
+            table.fill(0xFFFF);
+        }
+    };
+
+    enum class TokenClass : uint8_t
+    {
+        Run,
+        Copy,
+        Diff,
+        Table,
+        Raw,
+        //5bit values that fill the word in front of a raw word or at the end of the stream
+        Padding,
+    };
+
+    //token statistics of the frames encoded by QOI15Encoder<..., true>, frames of a camera can be summed up
+    struct EncoderStats
+    {
+        static constexpr int ClassCount = 6;
+        static constexpr int RunBuckets = 32;
+        static constexpr int DiffBuckets = 17;
+
+        //5bit values of each class, words for raw
+        std::array<uint64_t, ClassCount> counts{};
+        //bits each class adds to the stream, without the flag bit of packed words
+        std::array<uint64_t, ClassCount> bits{};
+        uint64_t runPixels = 0;
+        uint64_t copyPixels = 0;
+        //table misses that replaced another value
+        uint64_t tableCollisions = 0;
+        //bucket n counts the runs of 2^n to 2^(n+1)-1 pixels
+        std::array<uint64_t, RunBuckets> runHistogram{};
+        //entry n counts the differentials of magnitude n
+        std::array<uint64_t, DiffBuckets> diffHistogram{};
+
+        uint64_t GetCount(const TokenClass kind) const
+        {
+            return counts[static_cast<int>(kind)];
+        }
+
+        uint64_t GetBits(const TokenClass kind) const
+        {
+            return bits[static_cast<int>(kind)];
+        }
+
+        //pixels that were neither runs nor copies look up the table once
+        double GetTableHitRate() const
+        {
+            auto lookups = GetCount(TokenClass::Table) + GetCount(TokenClass::Raw);
+            return lookups != 0 ? static_cast<double>(GetCount(TokenClass::Table)) / lookups : 0.0;
+        }
+
+        double GetCollisionRate() const
+        {
+            auto lookups = GetCount(TokenClass::Table) + GetCount(TokenClass::Raw);
+            return lookups != 0 ? static_cast<double>(tableCollisions) / lookups : 0.0;
+        }
+
+        //3 padding values fill one word
+        double GetPaddingWords() const
+        {
+            return GetCount(TokenClass::Padding) / 3.0;
+        }
+
+        void Add(const TokenClass kind, const uint64_t count)
+        {
+            counts[static_cast<int>(kind)] += count;
+            bits[static_cast<int>(kind)] += count * (kind == TokenClass::Raw ? 16 : 5);
+        }
+
+        EncoderStats &operator+=(const EncoderStats &other)
+        {
+            for (auto i = 0; i < ClassCount; ++i)
+            {
+                counts[i] += other.counts[i];
+                bits[i] += other.bits[i];
+            }
+            runPixels += other.runPixels;
+            copyPixels += other.copyPixels;
+            tableCollisions += other.tableCollisions;
+            for (auto i = 0; i < RunBuckets; ++i)
+            {
+                runHistogram[i] += other.runHistogram[i];
+            }
+            for (auto i = 0; i < DiffBuckets; ++i)
+            {
+                diffHistogram[i] += other.diffHistogram[i];
+            }
+            return *this;
+        }
+    };
+
+    //stands in for EncoderStats when the encoder does not collect
+    struct NoEncoderStats
+    {
+    };
+
+    //collectStats selects an instantiation that fills GetStats(), the default one has no trace of it
+    template <int internalShift = 1, class RepositoryType = SpeedFirstRepository, Layout layout = DefaultLayout, bool collectStats = false>
+    class QOI15Encoder
+    {
+        static_assert((internalShift > 0 && internalShift <= MaxShift) || internalShift == LowStreamShift, "shift must be 1 to MaxShift, EncodeInto takes LosslessShift");
+
+        using Config = CodecConfig<internalShift, layout>;
+
+        typename Config::BitShifterType bitShifter_;
+        typename Config::RunLengthType runLength_;
+        typename Config::DifferentialType differential_;
+        typename Config::TableType table_;
+        typename Config::RawType raw_;
+
+        RepositoryType repository_;
+
+        std::conditional_t<collectStats, EncoderStats, NoEncoderStats> stats_;
+
+        SimdLevel simdLevel_;
+
+        //state carried between Push() calls
+        uint16_t pushPrevious_;
+        int pushRunLength_;
+
+        //row copy layout only
+        int width_;
+        int copyLength_;
+
+        void FlushRun(int &runLength)
+        {
+            if (runLength != 0)
+            {
+                uint8_t runValues[decltype(runLength_)::MaxCount];
+                auto runCount = runLength_.Get(runLength, runValues);
+                repository_.Set(runValues, runCount);
+                if constexpr (collectStats)
+                {
+                    stats_.Add(TokenClass::Run, runCount);
+                    stats_.runPixels += runLength;
+                    stats_.runHistogram[31 - CountLeadingZeros(static_cast<uint32_t>(runLength))]++;
+                }
+                runLength = 0;
+            }
+        }
+
+        void FlushCopy()
+        {
+            if constexpr (Config::HasCopy)
+            {
+                if (copyLength_ != 0)
+                {
+                    typename Config::CopyLengthType copyLength;
+                    uint8_t copyValues[Config::CopyLengthType::MaxCount];
+                    auto copyCount = copyLength.Get(copyLength_, copyValues);
+                    repository_.Set(copyValues, copyCount);
+                    if constexpr (collectStats)
+                    {
+                        stats_.Add(TokenClass::Copy, copyCount);
+                        stats_.copyPixels += copyLength_;
+                    }
+                    copyLength_ = 0;
+                }
+            }
+        }
+
+        void SetTableOrRaw(const uint16_t current)
+        {
+            auto hash = table_.Hash(current);
+            if (table_.Refer(hash) == current)
+            {
+                repository_.Set(table_.Get(hash));
+                if constexpr (collectStats)
+                {
+                    stats_.Add(TokenClass::Table, 1);
+                }
+                return;
+            }
+            if constexpr (collectStats)
+            {
+                stats_.tableCollisions += table_.Refer(hash) != 0xFFFF ? 1 : 0;
+                stats_.Add(TokenClass::Raw, 1);
+                CountPadding();
+            }
+            table_.Insert(hash, current);
+
+            repository_.Set(raw_.Get(current));
+        }
+
+        //the repository pads the word it flushes next
+        void CountPadding()
+        {
+            if constexpr (collectStats)
+            {
+                auto pending = repository_.GetPending();
+                if (pending != 0)
+                {
+                    stats_.Add(TokenClass::Padding, 3 - pending);
+                }
+            }
+        }
+
+        void CountDiff(const int32_t diff)
+        {
+            if constexpr (collectStats)
+            {
+                stats_.Add(TokenClass::Diff, 1);
+                stats_.diffHistogram[std::min(std::abs(diff), EncoderStats::DiffBuckets - 1)]++;
+            }
+        }
+
+        void Step(const uint16_t current, uint16_t &previous, int &runLength)
+        {
+            if (previous == current)
+            {
+                runLength++;
+                return;
+            }
+            FlushRun(runLength);
+
+            auto diff = differential_.Sub(previous, current);
+            previous = current;
+            if (differential_.IsValid(diff))
+            {
+                repository_.Set(differential_.Get(diff));
+                CountDiff(diff);
+                return;
+            }
+            SetTableOrRaw(current);
+        }
+
+        //first index from begin on whose pixel differs from the one a row above
+        int MatchRowAbove(const uint16_t *buffer, int begin, const int end)
+        {
+#ifdef QOI15_X86
+            if (simdLevel_ == SimdLevel::AVX2)
+            {
+                begin = MatchRowAboveAVX2(buffer, begin, end);
+            }
+#endif
+            while (begin < end && bitShifter_.Get(buffer[begin]) == bitShifter_.Get(buffer[begin - width_]))
+            {
+                begin++;
+            }
+            return begin;
+        }
+
+        //a pixel equal to the one a row above starts or extends a copy, constant spans stay runs
+        void ProcessCopyRange(const uint16_t *buffer, int begin, const int end, uint16_t &previous, int &runLength)
+        {
+            for (auto i = begin; i < end; ++i)
+            {
+                if (copyLength_ != 0)
+                {
+                    auto next = MatchRowAbove(buffer, i, end);
+                    if (next != i)
+                    {
+                        copyLength_ += next - i;
+                        previous = bitShifter_.Get(buffer[next - 1]);
+                        i = next - 1;
+                        continue;
+                    }
+                    FlushCopy();
+                }
+
+                auto current = bitShifter_.Get(buffer[i]);
+                if (current != previous && width_ > 0 && i >= width_ && current == bitShifter_.Get(buffer[i - width_]))
+                {
+                    FlushRun(runLength);
+                    copyLength_ = 1;
                     previous = current;
                     continue;
                 }
+                Step(current, previous, runLength);
+            }
+        }
+
+        //emits a block classified by a SIMD front end, bit j of the masks describes pixel j
+        void StepBlock(const uint16_t *currents, const uint8_t *diffValues, const uint32_t equalMask, const uint32_t diffMask,
+                       const int lanes, int &runLength)
+        {
+            auto j = 0;
+            while (j < lanes)
+            {
+                auto equalCount = CountTrailingZeros(~(equalMask >> j));
+                if (equalCount != 0)
+                {
+                    runLength += equalCount;
+                    j += equalCount;
+                    continue;
+                }
+                FlushRun(runLength);
+
+                auto diffCount = CountTrailingZeros(~(diffMask >> j));
+                if (diffCount != 0)
+                {
+                    repository_.Set(diffValues + j, diffCount);
+                    if constexpr (collectStats)
+                    {
+                        for (auto k = j; k < j + diffCount; ++k)
+                        {
+                            CountDiff(differential_.Set(diffValues[k]));
+                        }
+                    }
+                    j += diffCount;
+                    continue;
+                }
+                SetTableOrRaw(currents[j]);
+                j++;
+            }
+        }
+
+#ifdef QOI15_X86
+        //same as BitShifter::Get
+        QOI15_TARGET("avx2")
+        static __m256i ShiftDown(const __m256i value)
+        {
+            if constexpr (internalShift == LowStreamShift)
+            {
+                return _mm256_and_si256(value, _mm256_set1_epi16(0x7FFF));
+            }
+            else
+            {
+                return _mm256_srli_epi16(value, internalShift);
+            }
+        }
+
+        QOI15_TARGET("sse4.1")
+        static __m128i ShiftDown(const __m128i value)
+        {
+            if constexpr (internalShift == LowStreamShift)
+            {
+                return _mm_and_si128(value, _mm_set1_epi16(0x7FFF));
+            }
+            else
+            {
+                return _mm_srli_epi16(value, internalShift);
+            }
+        }
+
+        QOI15_TARGET("avx2")
+        int MatchRowAboveAVX2(const uint16_t *buffer, int begin, const int end)
+        {
+            //only the bits above the shift have to match, or the low 15bit of the low stream
+            const auto low = _mm256_set1_epi16(static_cast<int16_t>(internalShift == LowStreamShift ? 0x8000 : (1 << std::max(internalShift, 0)) - 1));
+            for (; begin + 16 <= end; begin += 16)
+            {
+                auto current = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(buffer + begin));
+                auto above = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(buffer + begin - width_));
+                auto difference = _mm256_andnot_si256(low, _mm256_xor_si256(current, above));
+                if (!_mm256_testz_si256(difference, difference))
+                {
+                    break;
+                }
+            }
+            return begin;
+        }
+
+        //classifies 16 pixels at a time against their left neighbour, begin must be 1 or more, returns the next index
+        QOI15_TARGET("avx2")
+        int ProcessAVX2(const uint16_t *buffer, const int begin, const int end, int &runLength)
+        {
+            using DifferentialType = typename Config::DifferentialType;
+            constexpr int lanes = 16;
+
+            const auto maxDiff = _mm256_set1_epi16(DifferentialType::MaxDiff);
+            const auto bias = _mm256_set1_epi16(DifferentialType::MaxDiff - 1);
+            const auto header = _mm256_set1_epi16(DifferentialType::Header);
+            const auto zero = _mm256_setzero_si256();
+            alignas(32) uint16_t currents[lanes];
+            alignas(16) uint8_t diffValues[lanes];
+
+            auto i = begin;
+            for (; i + lanes <= end; i += lanes)
+            {
+                auto current = ShiftDown(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(buffer + i)));
+                auto previous = ShiftDown(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(buffer + i - 1)));
+
+                auto equal = _mm256_cmpeq_epi16(current, previous);
+                auto equalMask = static_cast<uint32_t>(_mm_movemask_epi8(
+                    _mm_packs_epi16(_mm256_castsi256_si128(equal), _mm256_extracti128_si256(equal, 1))));
+                if (equalMask == 0xFFFF)
+                {
+                    runLength += lanes;
+                    continue;
+                }
+
+                //shifted values fit in 15bit, so the 16bit difference is exact
+                auto diff = _mm256_sub_epi16(current, previous);
+                auto outOfRange = _mm256_or_si256(_mm256_cmpgt_epi16(_mm256_abs_epi16(diff), maxDiff), equal);
+                auto diffMask = ~static_cast<uint32_t>(_mm_movemask_epi8(
+                                    _mm_packs_epi16(_mm256_castsi256_si128(outOfRange), _mm256_extracti128_si256(outOfRange, 1)))) &
+                                0xFFFF;
+
+                //same as Differential::Get, negative values get one more
+                auto value = _mm256_or_si256(_mm256_sub_epi16(_mm256_add_epi16(diff, bias), _mm256_cmpgt_epi16(zero, diff)), header);
+                _mm_store_si128(reinterpret_cast<__m128i *>(diffValues),
+                                _mm_packus_epi16(_mm256_castsi256_si128(value), _mm256_extracti128_si256(value, 1)));
+                _mm256_store_si256(reinterpret_cast<__m256i *>(currents), current);
+
+                StepBlock(currents, diffValues, equalMask, diffMask, lanes, runLength);
+            }
+            return i;
+        }
+
+        //8 pixel version of ProcessAVX2
+        QOI15_TARGET("sse4.1")
+        int ProcessSSE41(const uint16_t *buffer, const int begin, const int end, int &runLength)
+        {
+            using DifferentialType = typename Config::DifferentialType;
+            constexpr int lanes = 8;
+
+            const auto maxDiff = _mm_set1_epi16(DifferentialType::MaxDiff);
+            const auto bias = _mm_set1_epi16(DifferentialType::MaxDiff - 1);
+            const auto header = _mm_set1_epi16(DifferentialType::Header);
+            const auto zero = _mm_setzero_si128();
+            alignas(16) uint16_t currents[lanes];
+            alignas(16) uint8_t diffValues[16];
+
+            auto i = begin;
+            for (; i + lanes <= end; i += lanes)
+            {
+                auto current = ShiftDown(_mm_loadu_si128(reinterpret_cast<const __m128i *>(buffer + i)));
+                auto previous = ShiftDown(_mm_loadu_si128(reinterpret_cast<const __m128i *>(buffer + i - 1)));
+
+                auto equal = _mm_cmpeq_epi16(current, previous);
+                if (_mm_test_all_ones(equal))
+                {
+                    runLength += lanes;
+                    continue;
+                }
+                auto equalMask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_packs_epi16(equal, zero)));
+
+                auto diff = _mm_sub_epi16(current, previous);
+                auto outOfRange = _mm_or_si128(_mm_cmpgt_epi16(_mm_abs_epi16(diff), maxDiff), equal);
+                auto diffMask = ~static_cast<uint32_t>(_mm_movemask_epi8(_mm_packs_epi16(outOfRange, zero))) & 0xFF;
+
+                auto value = _mm_or_si128(_mm_sub_epi16(_mm_add_epi16(diff, bias), _mm_cmpgt_epi16(zero, diff)), header);
+                _mm_store_si128(reinterpret_cast<__m128i *>(diffValues), _mm_packus_epi16(value, zero));
+                _mm_store_si128(reinterpret_cast<__m128i *>(currents), current);
+
+                StepBlock(currents, diffValues, equalMask, diffMask, lanes, runLength);
+            }
+            return i;
+        }
+#endif
+
+        void ProcessRange(const uint16_t *buffer, int begin, const int end, uint16_t &previous, int &runLength)
+        {
+            if constexpr (Config::HasCopy)
+            {
+                ProcessCopyRange(buffer, begin, end, previous, runLength);
+                return;
+            }
+
+            //previous is always the shifted left neighbour from the second pixel on,
+            //so a SIMD front end can classify pixels without carrying it
+            if (begin == 0 && end > 0)
+            {
+                Step(bitShifter_.Get(buffer[0]), previous, runLength);
+                begin = 1;
+            }
+#ifdef QOI15_X86
+            if (begin < end)
+            {
+                if (simdLevel_ == SimdLevel::AVX2)
+                {
+                    begin = ProcessAVX2(buffer, begin, end, runLength);
+                }
+                else if (simdLevel_ == SimdLevel::SSE41)
+                {
+                    begin = ProcessSSE41(buffer, begin, end, runLength);
+                }
+                previous = bitShifter_.Get(buffer[begin - 1]);
+            }
+#endif
+
+            for (auto i = begin; i < end; ++i)
+            {
+                Step(bitShifter_.Get(buffer[i]), previous, runLength);
+            }
+        }
+
+        //points gets the state every interval pixels when it is given
+        void Process(const uint16_t *buffer, const int size, const int interval = 0, std::vector<RestartPoint> *points = nullptr)
+        {
+            static_assert(Config::TableType::Size <= RestartPoint::MaxTableSize, "table does not fit into a restart point");
+
+            uint16_t previous = 0xFFFF;
+            auto runLength = 0;
+            auto i = 0;
+
+            if (points != nullptr)
+            {
+                if (Config::HasCopy)
+                {
+                    throw std::invalid_argument("qoi15: restart points need the rows above with the row copy layout");
+                }
+                points->clear();
+                for (; i < size; i += interval)
+                {
+                    //a pending run has emitted nothing yet, so the point moves back to its first pixel
+                    RestartPoint point;
+                    point.wordOffset = static_cast<uint64_t>(repository_.GetSize());
+                    point.pixelOffset = static_cast<uint64_t>(i - runLength);
+                    point.valueIndex = static_cast<uint8_t>(repository_.GetPending());
+                    point.previous = previous;
+                    table_.Store(point.table.data());
+                    points->push_back(point);
+
+                    ProcessRange(buffer, i, std::min(i + interval, size), previous, runLength);
+                }
+            }
+            else
+            {
+                ProcessRange(buffer, 0, size, previous, runLength);
+            }
+            FlushCopy();
+            FlushRun(runLength);
+
+            CountPadding();
+            repository_.Flush();
+        }
+
+    public:
+        //reusable encoder, call Encode() for each frame
+        QOI15Encoder()
+            : repository_(), stats_(),
+              simdLevel_(DetectSimdLevel()), pushPrevious_(0xFFFF), pushRunLength_(0), width_(0), copyLength_(0)
+        {
+        }
+
+        QOI15Encoder(const uint16_t *buffer, const int size)
+            : QOI15Encoder()
+        {
+            Encode(buffer, size);
+        }
+
+        //out must hold MaxEncodedSize(size) words
+        QOI15Encoder(const uint16_t *buffer, const int size, uint16_t *out)
+            : QOI15Encoder()
+        {
+            Encode(buffer, size, out);
+        }
+
+        //forgets the previous frame so that the next one is encoded independently
+        void Reset()
+        {
+            table_.Reset();
+            repository_.Reset();
+            pushPrevious_ = 0xFFFF;
+            pushRunLength_ = 0;
+            copyLength_ = 0;
+            stats_ = {};
+        }
+
+        //encodes into the owned buffer, which is kept for the next frame
+        void Encode(const uint16_t *buffer, const int size)
+        {
+            Reset();
+            repository_.Reserve(static_cast<int>(MaxEncodedSize(size)));
+            Process(buffer, size);
+        }
+
+        //out must hold MaxEncodedSize(size) words
+        void Encode(const uint16_t *buffer, const int size, uint16_t *out)
+        {
+            Reset();
+            repository_.Attach(out);
+            Process(buffer, size);
+        }
+
+        //same stream, plus a restart point in front of every interval pixels, e.g. every K rows
+        void Encode(const uint16_t *buffer, const int size, uint16_t *out, const int interval, std::vector<RestartPoint> &points)
+        {
+            if (interval <= 0)
+            {
+                throw std::invalid_argument("qoi15: restart interval must be positive");
+            }
+            Reset();
+            repository_.Attach(out);
+            Process(buffer, size, interval, &points);
+        }
+
+        //continues the frame started by Reset() with the next size pixels, the stream equals one Encode() of all pushes
+        void Push(const uint16_t *buffer, const int size)
+        {
+            static_assert(!Config::HasCopy, "the row copy layout needs the whole frame");
+            ProcessRange(buffer, 0, size, pushPrevious_, pushRunLength_);
+        }
+
+        //writes the pending run and the last partial word of the pushed frame
+        void Finish()
+        {
+            FlushRun(pushRunLength_);
+            CountPadding();
+            repository_.Flush();
+        }
+
+        std::tuple<const uint16_t *, int> Get()
+        {
+            return {repository_.GetIterator(), repository_.GetSize()};
+        }
+
+        RepositoryType &GetRepository()
+        {
+            return repository_;
+        }
+
+        //row length for the row copy layout, copies are only made when it is set
+        void SetWidth(const int width)
+        {
+            width_ = width;
+        }
+
+        //the output does not depend on the level, levels above the CPU's are lowered
+        void SetSimdLevel(const SimdLevel level)
+        {
+            simdLevel_ = level < DetectSimdLevel() ? level : DetectSimdLevel();
+        }
+
+        //statistics of the frame since the last Reset()
+        const EncoderStats &GetStats() const
+        {
+            static_assert(collectStats, "the encoder does not collect statistics");
+            return stats_;
+        }
+    };
+
+    template <int internalShift = 1, class RepositoryType = SpeedFirstRepository, Layout layout = DefaultLayout>
+    class QOI15Decoder
+    {
+        static_assert((internalShift > 0 && internalShift <= MaxShift) || internalShift == LowStreamShift, "shift must be 1 to MaxShift, DecodeInto takes LosslessShift");
+
+        using Config = CodecConfig<internalShift, layout>;
+        using WordTableType = typename Config::WordTableType;
+
+        typename Config::BitShifterType bitShifter_;
+        typename Config::RunLengthType runLength_;
+        typename Config::DifferentialType differential_;
+        typename Config::TableType table_;
+        typename Config::RawType raw_;
+
+        RepositoryType repository_;
+
+        //row copy layout only
+        int width_;
+
+        //a run never writes beyond the output size
+        void Repeat(const uint16_t value, const uint32_t length, int &remaining)
+        {
+            auto count = length < static_cast<uint32_t>(remaining) ? static_cast<int>(length) : remaining;
+            repository_.Fill(bitShifter_.Set(value), count);
+            remaining -= count;
+        }
+
+        //expands a pending row copy, nothing for the other layouts
+        void EndCopy(uint32_t &copyLength, int &copyShift, int &remaining, uint16_t &previous)
+        {
+            if constexpr (Config::HasCopy)
+            {
+                if (copyShift != 0)
+                {
+                    auto count = copyLength < static_cast<uint32_t>(remaining) ? static_cast<int>(copyLength) : remaining;
+                    if (count != 0)
+                    {
+                        if (width_ <= 0 || repository_.GetSize() < width_)
+                        {
+                            throw std::runtime_error("qoi15: row copy without a row above");
+                        }
+                        previous = bitShifter_.Get(repository_.Copy(width_, count));
+                        remaining -= count;
+                    }
+                    copyLength = 0;
+                    copyShift = 0;
+                }
+            }
+        }
+
+        //skip values of the first word belong to pixels before the output
+        void Process(const uint16_t *buffer, const int size, const int outputSize, uint16_t previous = 0xFFFF, int skip = 0)
+        {
+            const auto &wordTable = WordTableType::Instance();
+
+            auto remaining = outputSize;
+
+            //run values are accumulated until a non run value ends them
+            uint32_t runLength = 0;
+            auto runShift = 0;
+
+            //same for row copies, a run ends a copy and a copy ends a run
+            uint32_t copyLength = 0;
+            auto copyShift = 0;
+
+            for (auto counter = 0; counter < size; ++counter)
+            {
+                auto value = buffer[counter];
+
+                if (raw_.IsValid(value))
+                {
+                    EndCopy(copyLength, copyShift, remaining, previous);
+                    if (runShift != 0)
+                    {
+                        Repeat(previous, runLength, remaining);
+                        runLength = 0;
+                        runShift = 0;
+                    }
+                    if (remaining == 0)
+                    {
+                        return;
+                    }
+
+                    auto current = raw_.Set(value);
+                    auto hash = table_.Hash(current);
+                    table_.Insert(hash, current);
+                    repository_.Write(bitShifter_.Set(current));
+                    remaining--;
+                    previous = current;
+                    continue;
+                }
+
+                //a skipped word has its flag shifted out as well
+                auto actions = wordTable.Get(value) >> (skip * 8);
+                if ((actions & WordTableType::AllDiffFlag) != 0)
+                {
+                    EndCopy(copyLength, copyShift, remaining, previous);
+                    if (runShift != 0)
+                    {
+                        Repeat(previous, runLength, remaining);
+                        runLength = 0;
+                        runShift = 0;
+                    }
+                    //prefix sums of the 3 diffs, so that the values only depend on previous, not on each other
+                    if (remaining >= 3)
+                    {
+                        auto first = static_cast<int32_t>(actions & WordTableType::OperandMask) - WordTableType::DiffBias;
+                        auto second = first + static_cast<int32_t>((actions >> 8) & WordTableType::OperandMask) - WordTableType::DiffBias;
+                        auto third = second + static_cast<int32_t>((actions >> 16) & WordTableType::OperandMask) - WordTableType::DiffBias;
+                        repository_.Write(bitShifter_.Set(differential_.Add(previous, first)));
+                        repository_.Write(bitShifter_.Set(differential_.Add(previous, second)));
+                        previous = differential_.Add(previous, third);
+                        repository_.Write(bitShifter_.Set(previous));
+                        remaining -= 3;
+                        continue;
+                    }
+                }
+
+                auto first = skip;
+                skip = 0;
+                for (auto i = first; i < 3; ++i, actions >>= 8)
+                {
+                    auto action = static_cast<uint8_t>(actions);
+                    auto operand = action & WordTableType::OperandMask;
+                    auto kind = action & WordTableType::KindMask;
+
+                    if (kind == WordTableType::RunAction)
+                    {
+                        EndCopy(copyLength, copyShift, remaining, previous);
+                        //padding values beyond int range carry no length
+                        if (runShift < 32)
+                        {
+                            runLength |= static_cast<uint32_t>(operand) << runShift;
+                        }
+                        runShift += decltype(runLength_)::ValueBit;
+                        continue;
+                    }
+
+                    if (runShift != 0)
+                    {
+                        Repeat(previous, runLength, remaining);
+                        runLength = 0;
+                        runShift = 0;
+                    }
+
+                    if constexpr (Config::HasCopy)
+                    {
+                        if (kind == WordTableType::CopyAction)
+                        {
+                            if (copyShift < 32)
+                            {
+                                copyLength |= static_cast<uint32_t>(operand) << copyShift;
+                            }
+                            copyShift += Config::CopyLengthType::ValueBit;
+                            continue;
+                        }
+                    }
+
+                    EndCopy(copyLength, copyShift, remaining, previous);
+                    if (remaining == 0)
+                    {
+                        return;
+                    }
+
+                    if (kind == WordTableType::DiffAction)
+                    {
+                        previous = differential_.Add(previous, operand - WordTableType::DiffBias);
+                    }
+                    else
+                    {
+                        previous = table_.Refer(static_cast<uint8_t>(operand));
+                    }
+                    repository_.Write(bitShifter_.Set(previous));
+                    remaining--;
+                }
+            }
+
+            EndCopy(copyLength, copyShift, remaining, previous);
+            if (runShift != 0)
+            {
+                Repeat(previous, runLength, remaining);
+            }
+        }
+
+    public:
+        //reusable decoder, call Decode() for each stream
+        QOI15Decoder()
+            : repository_(), width_(0)
+        {
+        }
+
+        QOI15Decoder(const uint16_t *buffer, const int size, const int outputSize)
+            : QOI15Decoder()
+        {
+            Decode(buffer, size, outputSize);
+        }
+
+        //writes at most outCapacity pixels into out
+        QOI15Decoder(const uint16_t *buffer, const int size, uint16_t *out, const int outCapacity)
+            : QOI15Decoder()
+        {
+            Decode(buffer, size, out, outCapacity);
+        }
+
+        //forgets the previous stream so that the next one is decoded independently
+        void Reset()
+        {
+            table_.Reset();
+            repository_.Reset();
+        }
+
+        //decodes into the owned buffer, which is kept for the next stream
+        void Decode(const uint16_t *buffer, const int size, const int outputSize)
+        {
+            Reset();
+            repository_.Reserve(outputSize);
+            Process(buffer, size, outputSize);
+        }
+
+        //writes at most outCapacity pixels into out
+        void Decode(const uint16_t *buffer, const int size, uint16_t *out, const int outCapacity)
+        {
+            Reset();
+            repository_.Attach(out);
+            Process(buffer, size, outCapacity);
+        }
+
+        //buffer is the whole stream, out receives the pixels from point.pixelOffset on
+        void Decode(const uint16_t *buffer, const int size, const RestartPoint &point, uint16_t *out, const int outCapacity)
+        {
+            static_assert(!Config::HasCopy, "the row copy layout needs the rows above");
+            if (point.wordOffset > static_cast<uint64_t>(size) || point.valueIndex > 2)
+            {
+                throw std::invalid_argument("qoi15: restart point is outside the stream");
+            }
+            Reset();
+            table_.Load(point.table.data());
+            repository_.Attach(out);
+            Process(buffer + point.wordOffset, size - static_cast<int>(point.wordOffset), outCapacity, point.previous, point.valueIndex);
+        }
+
+        std::tuple<const uint16_t *, int> Get()
+        {
+            return {repository_.GetIterator(), repository_.GetSize()};
+        }
+
+        RepositoryType &GetRepository()
+        {
+            return repository_;
+        }
+
+        //row length of a row copy stream
+        void SetWidth(const int width)
+        {
+            width_ = width;
+        }
+    };
+
+    //the codec counts pixels and words in int, more than it can count throws
+    inline int CheckedCount(const size_t count)
+    {
+        if (count > static_cast<size_t>(std::numeric_limits<int>::max()))
+        {
+            throw std::length_error("qoi15: more pixels or words than the codec can count");
+        }
+        return static_cast<int>(count);
+    }
+
+    //a capacity beyond what the codec can count is as good as the largest it can
+    inline int ClampedCapacity(const size_t capacity)
+    {
+        return static_cast<int>(std::min<size_t>(capacity, static_cast<size_t>(std::numeric_limits<int>::max())));
+    }
+
+    //one stream of EncodeInto(), returns the number of words
+    template <int internalShift, bool collectStats>
+    int EncodeStream(const uint16_t *buffer, const size_t size, uint16_t *out, EncoderStats *stats)
+    {
+        QOI15Encoder<internalShift, SpeedFirstRepository, DefaultLayout, collectStats> encoder(buffer, CheckedCount(size), out);
+        if constexpr (collectStats)
+        {
+            *stats += encoder.GetStats();
+        }
+        return std::get<1>(encoder.Get());
+    }
+
+    //returns the number of words written into out, adds the statistics of the frame to stats when it is given
+    //LosslessShift writes [low 15bit stream][MSB stream][low 15bit stream word count, low half first]
+    template <int internalShift = 1>
+    size_t EncodeInto(const uint16_t *buffer, const size_t size, uint16_t *out, const size_t outCapacity, EncoderStats *stats = nullptr)
+    {
+        CheckedCount(size);
+        if (outCapacity < MaxEncodedSize(size, internalShift))
+        {
+            throw std::length_error("qoi15: output capacity is smaller than MaxEncodedSize");
+        }
+
+        static_assert(internalShift >= LosslessShift && internalShift <= MaxShift, "shift must be LosslessShift to MaxShift");
+        constexpr auto streamShift = internalShift == LosslessShift ? LowStreamShift : internalShift;
+        auto written = stats != nullptr ? EncodeStream<streamShift, true>(buffer, size, out, stats)
+                                        : EncodeStream<streamShift, false>(buffer, size, out, stats);
+        if constexpr (internalShift == LosslessShift)
+        {
+            auto msbWritten = stats != nullptr ? EncodeStream<MaxShift, true>(buffer, size, out + written, stats)
+                                               : EncodeStream<MaxShift, false>(buffer, size, out + written, stats);
+            out[written + msbWritten + 0] = static_cast<uint16_t>(written);
+            out[written + msbWritten + 1] = static_cast<uint16_t>(static_cast<uint32_t>(written) >> 16);
+            return static_cast<size_t>(written) + msbWritten + 2;
+        }
+        return static_cast<size_t>(written);
+    }
+
+    //returns the number of pixels written into out
+    template <int internalShift = 1>
+    size_t DecodeInto(const uint16_t *buffer, const size_t size, uint16_t *out, const size_t outCapacity)
+    {
+        static_assert(internalShift >= LosslessShift && internalShift <= MaxShift, "shift must be LosslessShift to MaxShift");
+        if constexpr (internalShift == LosslessShift)
+        {
+            CheckedCount(size);
+            if (size < 2)
+            {
+                throw std::runtime_error("qoi15: lossless stream without a trailer");
+            }
+            auto words = static_cast<size_t>(buffer[size - 2]) | static_cast<size_t>(buffer[size - 1]) << 16;
+            if (words > size - 2)
+            {
+                throw std::runtime_error("qoi15: inconsistent lossless trailer");
+            }
+
+            QOI15Decoder<LowStreamShift> decoder(buffer, static_cast<int>(words), out, ClampedCapacity(outCapacity));
+            auto [_, written] = decoder.Get();
+
+            //the MSBs are ored into the pixels the low 15bit stream has written
+            QOI15Decoder<MaxShift, MergeRepository> msbDecoder;
+            msbDecoder.Decode(buffer + words, static_cast<int>(size - 2 - words), out, written);
+            return static_cast<size_t>(written);
+        }
+        else
+        {
+            QOI15Decoder<internalShift> decoder(buffer, CheckedCount(size), out, ClampedCapacity(outCapacity));
+            auto [_, written] = decoder.Get();
+            return static_cast<size_t>(written);
+        }
+    }
+
+    template <int... shifts>
+    size_t EncodeInto(const int internalShift, const uint16_t *buffer, const size_t size, uint16_t *out, const size_t outCapacity,
+                      EncoderStats *stats, std::integer_sequence<int, shifts...>)
+    {
+        using Function = size_t (*)(const uint16_t *, const size_t, uint16_t *, const size_t, EncoderStats *);
+        static constexpr Function functions[] = {&EncodeInto<shifts>...};
+
+        if (internalShift < LosslessShift || internalShift > MaxShift)
+        {
+            throw std::invalid_argument("qoi15: unsupported shift");
+        }
+        return functions[internalShift](buffer, size, out, outCapacity, stats);
+    }
+
+    template <int... shifts>
+    size_t DecodeInto(const int internalShift, const uint16_t *buffer, const size_t size, uint16_t *out, const size_t outCapacity,
+                      std::integer_sequence<int, shifts...>)
+    {
+        using Function = size_t (*)(const uint16_t *, const size_t, uint16_t *, const size_t);
+        static constexpr Function functions[] = {&DecodeInto<shifts>...};
+
+        if (internalShift < LosslessShift || internalShift > MaxShift)
+        {
+            throw std::invalid_argument("qoi15: unsupported shift");
+        }
+        return functions[internalShift](buffer, size, out, outCapacity);
+    }
+
+    //runtime shift, dispatched to the kernel compiled for that shift, statistics are collected only when stats is given
+    inline size_t EncodeInto(const int internalShift, const uint16_t *buffer, const size_t size, uint16_t *out, const size_t outCapacity,
+                             EncoderStats *stats = nullptr)
+    {
+        return EncodeInto(internalShift, buffer, size, out, outCapacity, stats, std::make_integer_sequence<int, MaxShift + 1>());
+    }
+
+    //runtime shift, e.g. taken from a stream header, dispatched to the kernel compiled for that shift
+    inline size_t DecodeInto(const int internalShift, const uint16_t *buffer, const size_t size, uint16_t *out, const size_t outCapacity)
+    {
+        return DecodeInto(internalShift, buffer, size, out, outCapacity, std::make_integer_sequence<int, MaxShift + 1>());
+    }
+
+    //fixed set of workers for fork-join loops, Run() must not be called concurrently
+    class ThreadPool
+    {
+        std::vector<std::thread> threads_;
+        std::mutex mutex_;
+        std::condition_variable start_;
+        std::condition_variable finish_;
+
+        const std::function<void(int)> *task_;
+        int count_;
+        std::atomic<int> next_;
+        int running_;
+        uint64_t generation_;
+        bool stop_;
+        std::exception_ptr error_;
+
+        //the first exception skips the indices nobody has taken yet, Run() rethrows it
+        void Work(const std::function<void(int)> &task, const int count)
+        {
+            try
+            {
+                for (auto i = next_++; i < count; i = next_++)
+                {
+                    task(i);
+                }
+            }
+            catch (...)
+            {
+                next_ = count;
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!error_)
+                {
+                    error_ = std::current_exception();
+                }
+            }
+        }
+
+        void Loop()
+        {
+            uint64_t generation = 0;
+            while (true)
+            {
+                const std::function<void(int)> *task;
+                int count;
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    start_.wait(lock, [&]() { return stop_ || generation_ != generation; });
+                    if (stop_)
+                    {
+                        return;
+                    }
+                    generation = generation_;
+                    task = task_;
+                    count = count_;
+                }
+
+                Work(*task, count);
+
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (--running_ == 0)
+                {
+                    finish_.notify_all();
+                }
+            }
+        }
+
+    public:
+        //0 uses every hardware thread, the calling thread counts as one of them
+        explicit ThreadPool(const int threads = 0)
+            : task_(nullptr), count_(0), next_(0), running_(0), generation_(0), stop_(false)
+        {
+            auto size = threads > 0 ? threads : static_cast<int>(std::thread::hardware_concurrency());
+            for (auto i = 1; i < size; ++i)
+            {
+                threads_.emplace_back(&ThreadPool::Loop, this);
+            }
+        }
+
+        ThreadPool(const ThreadPool &) = delete;
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            start_.notify_all();
+            for (auto &thread : threads_)
+            {
+                thread.join();
+            }
+        }
+
+        int GetSize() const
+        {
+            return static_cast<int>(threads_.size()) + 1;
+        }
+
+        //calls task(0) ... task(count - 1) in parallel and waits for all of them,
+        //an exception of any task is rethrown here once every worker has left the batch
+        void Run(const int count, const std::function<void(int)> &task)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                task_ = &task;
+                count_ = count;
+                next_ = 0;
+                running_ = static_cast<int>(threads_.size());
+                generation_++;
+                error_ = nullptr;
+            }
+            start_.notify_all();
+
+            Work(task, count);
+
+            std::exception_ptr error;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                finish_.wait(lock, [&]() { return running_ == 0; });
+                std::swap(error, error_);
+            }
+            if (error)
+            {
+                std::rethrow_exception(error);
+            }
+        }
+    };
+
+    //start of a stripe, codec state is reset there
+    struct StripeEntry
+    {
+        uint64_t wordOffset;
+        uint64_t pixelOffset;
+    };
+
+    //splits a frame into horizontal stripes and encodes them in parallel
+    template <int internalShift = 1>
+    class StripeEncoder
+    {
+        static_assert(internalShift > 0 && internalShift <= MaxShift, "shift must be 1 to MaxShift");
+
+        ThreadPool pool_;
+        std::vector<std::unique_ptr<QOI15Encoder<internalShift>>> encoders_;
+        std::vector<StripeEntry> index_;
+        std::vector<uint64_t> sizes_;
+
+    public:
+        explicit StripeEncoder(const int threads = 0)
+            : pool_(threads)
+        {
+        }
+
+        //out must hold MaxEncodedSize(width * height) words, returns the number of words written
+        size_t Encode(const uint16_t *buffer, const int width, const int height, int stripes, uint16_t *out, const size_t outCapacity)
+        {
+            auto pixels = static_cast<size_t>(width) * height;
+            if (outCapacity < MaxEncodedSize(pixels))
+            {
+                throw std::length_error("qoi15: output capacity is smaller than MaxEncodedSize");
+            }
+
+            stripes = std::max(1, std::min(stripes, height));
+            while (static_cast<int>(encoders_.size()) < stripes)
+            {
+                encoders_.emplace_back(new QOI15Encoder<internalShift>());
+            }
+            index_.resize(stripes);
+            sizes_.resize(stripes);
+            for (auto i = 0; i < stripes; ++i)
+            {
+                index_[i].pixelOffset = static_cast<uint64_t>(height) * i / stripes * width;
+            }
+
+            //each stripe is encoded at its worst-case position, MaxEncodedSize(pixelOffset)
+            pool_.Run(stripes, [&](const int i)
+                      {
+                          auto begin = index_[i].pixelOffset;
+                          auto end = i + 1 < stripes ? index_[i + 1].pixelOffset : pixels;
+                          auto &encoder = *encoders_[i];
+                          encoder.Encode(buffer + begin, static_cast<int>(end - begin), out + MaxEncodedSize(begin));
+                          sizes_[i] = std::get<1>(encoder.Get());
+                      });
+
+            //then packed to the front, never overlapping a stripe not moved yet
+            uint64_t wordOffset = 0;
+            for (auto i = 0; i < stripes; ++i)
+            {
+                auto begin = out + MaxEncodedSize(index_[i].pixelOffset);
+                std::copy(begin, begin + sizes_[i], out + wordOffset);
+                index_[i].wordOffset = wordOffset;
+                wordOffset += sizes_[i];
+            }
+            return static_cast<size_t>(wordOffset);
+        }
+
+        //one entry per stripe of the last frame
+        const std::vector<StripeEntry> &GetIndex() const
+        {
+            return index_;
+        }
+    };
+
+    //decodes the stripes of a StripeEncoder stream in parallel, each one straight into its part of the output
+    template <int internalShift = 1>
+    class StripeDecoder
+    {
+        static_assert(internalShift > 0 && internalShift <= MaxShift, "shift must be 1 to MaxShift");
+
+        ThreadPool pool_;
+        std::vector<std::unique_ptr<QOI15Decoder<internalShift>>> decoders_;
+        std::vector<uint64_t> sizes_;
+
+    public:
+        explicit StripeDecoder(const int threads = 0)
+            : pool_(threads)
+        {
+        }
+
+        //the last stripe ends at outCapacity, returns the number of pixels written
+        size_t Decode(const uint16_t *buffer, const size_t size, const std::vector<StripeEntry> &index, uint16_t *out, const size_t outCapacity)
+        {
+            auto stripes = static_cast<int>(index.size());
+            for (auto i = 0; i < stripes; ++i)
+            {
+                auto wordEnd = i + 1 < stripes ? index[i + 1].wordOffset : size;
+                auto pixelEnd = i + 1 < stripes ? index[i + 1].pixelOffset : outCapacity;
+                if (index[i].wordOffset > wordEnd || index[i].pixelOffset > pixelEnd || wordEnd > size || pixelEnd > outCapacity)
+                {
+                    throw std::invalid_argument("qoi15: stripe index does not match the stream");
+                }
+            }
+
+            while (static_cast<int>(decoders_.size()) < stripes)
+            {
+                decoders_.emplace_back(new QOI15Decoder<internalShift>());
+            }
+            sizes_.resize(stripes);
+
+            pool_.Run(stripes, [&](const int i)
+                      {
+                          auto wordEnd = i + 1 < stripes ? index[i + 1].wordOffset : size;
+                          auto pixelEnd = i + 1 < stripes ? index[i + 1].pixelOffset : outCapacity;
+                          auto &decoder = *decoders_[i];
+                          decoder.Decode(buffer + index[i].wordOffset, static_cast<int>(wordEnd - index[i].wordOffset),
+                                         out + index[i].pixelOffset, static_cast<int>(pixelEnd - index[i].pixelOffset));
+                          sizes_[i] = std::get<1>(decoder.Get());
+                      });
+
+            uint64_t written = 0;
+            for (auto i = 0; i < stripes; ++i)
+            {
+                written += sizes_[i];
+            }
+            return static_cast<size_t>(written);
+        }
+    };
+
+    //CRC32C (Castagnoli), bitwise reflected, one table lookup per byte
+    inline uint32_t Crc32cScalar(const uint8_t *data, const size_t size, uint32_t crc)
+    {
+        static const auto table = []()
+        {
+            std::array<uint32_t, 256> result{};
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                auto value = i;
+                for (auto bit = 0; bit < 8; ++bit)
+                {
+                    value = (value >> 1) ^ ((value & 1) ? 0x82F63B78u : 0u);
+                }
+                result[i] = value;
+            }
+            return result;
+        }();
+
+        for (size_t i = 0; i < size; ++i)
+        {
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+#if defined(QOI15_X86)
+    QOI15_TARGET("sse4.2")
+    inline uint32_t Crc32cSSE42(const uint8_t *data, const size_t size, uint32_t crc)
+    {
+        size_t i = 0;
+#if defined(__x86_64__) || defined(_M_X64)
+        uint64_t wide = crc;
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64_t value;
+            std::memcpy(&value, data + i, 8);
+            wide = _mm_crc32_u64(wide, value);
+        }
+        crc = static_cast<uint32_t>(wide);
+#endif
+        for (; i + 4 <= size; i += 4)
+        {
+            uint32_t value;
+            std::memcpy(&value, data + i, 4);
+            crc = _mm_crc32_u32(crc, value);
+        }
+        for (; i < size; ++i)
+        {
+            crc = _mm_crc32_u8(crc, data[i]);
+        }
+        return crc;
+    }
+#endif
+
+    //pass the previous result as crc to continue a checksum over several blocks
+    inline uint32_t Crc32c(const uint8_t *data, const size_t size, const uint32_t crc = 0)
+    {
+#if defined(QOI15_X86)
+        if (DetectCrc32())
+        {
+            return ~Crc32cSSE42(data, size, ~crc);
+        }
+#endif
+        return ~Crc32cScalar(data, size, ~crc);
+    }
+
+    //words of the bits a shift drops, densely packed
+    inline size_t LowBitsSize(const size_t pixels, const int internalShift)
+    {
+        return (pixels * static_cast<size_t>(internalShift) + 15) / 16;
+    }
+
+    //bit accumulator of PackLowBits() and UnpackLowBits(), words enter and leave at the low end
+    struct LowBitsState
+    {
+        size_t pixel = 0;
+        size_t word = 0;
+        uint64_t bits = 0;
+        int count = 0;
+    };
+
+#ifdef QOI15_BMI2
+    //pext gathers the low bits of 4 pixels at once, up to shift 12 so that they fit next to 15 pending bits
+    QOI15_TARGET("bmi2")
+    inline void PackLowBitsBMI2(const uint16_t *pixels, const size_t size, uint16_t *out, const int internalShift, LowBitsState &state)
+    {
+        const auto laneMask = ((1ull << internalShift) - 1) * 0x0001000100010001ull;
+        const auto step = 4 * internalShift;
+        auto pixel = state.pixel;
+        auto word = state.word;
+        auto bits = state.bits;
+        auto count = state.count;
+        for (; pixel + 4 <= size; pixel += 4)
+        {
+            uint64_t block;
+            std::memcpy(&block, pixels + pixel, sizeof(block));
+            bits |= _pext_u64(block, laneMask) << count;
+            count += step;
+            if (count >= 32)
+            {
+                auto low = static_cast<uint32_t>(bits);
+                std::memcpy(out + word, &low, sizeof(low));
+                word += 2;
+                bits >>= 32;
+                count -= 32;
+            }
+            if (count >= 16)
+            {
+                out[word++] = static_cast<uint16_t>(bits);
+                bits >>= 16;
+                count -= 16;
+            }
+        }
+        state = {pixel, word, bits, count};
+    }
+
+    //pdep scatters them back
+    QOI15_TARGET("bmi2")
+    inline void UnpackLowBitsBMI2(const uint16_t *in, uint16_t *pixels, const size_t size, const int internalShift, LowBitsState &state)
+    {
+        const auto laneMask = ((1ull << internalShift) - 1) * 0x0001000100010001ull;
+        const auto step = 4 * internalShift;
+        auto pixel = state.pixel;
+        auto word = state.word;
+        auto bits = state.bits;
+        auto count = state.count;
+        const auto words = LowBitsSize(size, internalShift);
+        for (; pixel + 4 <= size; pixel += 4)
+        {
+            //2 words at once while they fit
+            if (count < step && count <= 32 && word + 2 <= words)
+            {
+                uint32_t low;
+                std::memcpy(&low, in + word, sizeof(low));
+                bits |= static_cast<uint64_t>(low) << count;
+                word += 2;
+                count += 32;
+            }
+            while (count < step)
+            {
+                bits |= static_cast<uint64_t>(in[word++]) << count;
+                count += 16;
+            }
+            uint64_t block;
+            std::memcpy(&block, pixels + pixel, sizeof(block));
+            block |= _pdep_u64(bits, laneMask);
+            std::memcpy(pixels + pixel, &block, sizeof(block));
+            bits >>= step;
+            count -= step;
+        }
+        state = {pixel, word, bits, count};
+    }
+#endif
+
+    //stores the bits below internalShift of every pixel, pixel 0 in the lowest bits of word 0,
+    //out must hold LowBitsSize(size, internalShift) words, returns that size
+    inline size_t PackLowBits(const uint16_t *pixels, const size_t size, uint16_t *out, const int internalShift)
+    {
+        if (internalShift < 1 || internalShift > MaxShift)
+        {
+            throw std::invalid_argument("qoi15: unsupported shift");
+        }
+        LowBitsState state;
+#ifdef QOI15_BMI2
+        if (DetectBmi2() && internalShift <= 12)
+        {
+            PackLowBitsBMI2(pixels, size, out, internalShift, state);
+        }
+#endif
+        const auto lane = static_cast<uint16_t>((1 << internalShift) - 1);
+        for (; state.pixel < size; ++state.pixel)
+        {
+            state.bits |= static_cast<uint64_t>(pixels[state.pixel] & lane) << state.count;
+            state.count += internalShift;
+            if (state.count >= 16)
+            {
+                out[state.word++] = static_cast<uint16_t>(state.bits);
+                state.bits >>= 16;
+                state.count -= 16;
+            }
+        }
+        if (state.count > 0)
+        {
+            out[state.word++] = static_cast<uint16_t>(state.bits);
+        }
+        return state.word;
+    }
+
+    //ors the bits stored by PackLowBits() into pixels decoded with the same shift, which leaves them 0
+    inline void UnpackLowBits(const uint16_t *in, const size_t words, uint16_t *pixels, const size_t size, const int internalShift)
+    {
+        if (internalShift < 1 || internalShift > MaxShift)
+        {
+            throw std::invalid_argument("qoi15: unsupported shift");
+        }
+        if (words < LowBitsSize(size, internalShift))
+        {
+            throw std::runtime_error("qoi15: low bits end before the image");
+        }
+        LowBitsState state;
+#ifdef QOI15_BMI2
+        if (DetectBmi2() && internalShift <= 12)
+        {
+            UnpackLowBitsBMI2(in, pixels, size, internalShift, state);
+        }
+#endif
+        const auto lane = static_cast<uint16_t>((1 << internalShift) - 1);
+        for (; state.pixel < size; ++state.pixel)
+        {
+            if (state.count < internalShift)
+            {
+                state.bits |= static_cast<uint64_t>(in[state.word++]) << state.count;
+                state.count += 16;
+            }
+            pixels[state.pixel] |= static_cast<uint16_t>(state.bits) & lane;
+            state.bits >>= internalShift;
+            state.count -= internalShift;
+        }
+    }
+
+    //half the range the codec sees, the lossless payload puts the top bit into a stream of its own,
+    //so its residuals are centred in the low 15 bits where the top bit stays 0
+    inline uint16_t ResidualBias(const int internalShift)
+    {
+        return static_cast<uint16_t>(1 << (internalShift == LosslessShift ? 14 : 15 - internalShift));
+    }
+
+    //residual against the co-located pixel of a reference frame, biased by half the range so that small changes
+    //either way stay close together and reach the differential and run tokens, bits below the shift are dropped
+    inline void ToTemporalResidual(const uint16_t *current, const uint16_t *reference, uint16_t *residual, const size_t size,
+                                   const int internalShift)
+    {
+        const auto mask = static_cast<uint16_t>(0xFFFF >> internalShift);
+        const auto bias = ResidualBias(internalShift);
+        for (size_t i = 0; i < size; ++i)
+        {
+            auto value = static_cast<uint16_t>((current[i] >> internalShift) - (reference[i] >> internalShift) + bias) & mask;
+            residual[i] = static_cast<uint16_t>(value << internalShift);
+        }
+    }
+
+    //inverse of ToTemporalResidual, current may be the residual buffer
+    inline void FromTemporalResidual(const uint16_t *residual, const uint16_t *reference, uint16_t *current, const size_t size,
+                                     const int internalShift)
+    {
+        const auto mask = static_cast<uint16_t>(0xFFFF >> internalShift);
+        const auto bias = ResidualBias(internalShift);
+        for (size_t i = 0; i < size; ++i)
+        {
+            auto value = static_cast<uint16_t>((residual[i] >> internalShift) + (reference[i] >> internalShift) - bias) & mask;
+            current[i] = static_cast<uint16_t>(value << internalShift);
+        }
+    }
+
+    //median edge detector of LOCO-I: left a, top b, top left c
+    inline uint16_t PredictMed(const uint16_t a, const uint16_t b, const uint16_t c)
+    {
+        auto low = std::min(a, b);
+        auto high = std::max(a, b);
+        return c >= high ? low : (c <= low ? high : static_cast<uint16_t>(a + b - c));
+    }
+
+    enum class Prediction : uint8_t
+    {
+        None = 0,
+        Med = 1,
+    };
+
+    //residual against the MED prediction from the left, top and top left pixels, biased like ToTemporalResidual,
+    //rows that are a multiple of restartRows are predicted from the left only, so that they decode without the rows above
+    inline void ToMedResidual(const uint16_t *current, uint16_t *residual, const size_t width, const size_t height,
+                              const int internalShift, const size_t restartRows = 0)
+    {
+        const auto mask = static_cast<uint16_t>(0xFFFF >> internalShift);
+        const auto bias = ResidualBias(internalShift);
+        for (size_t y = 0; y < height; ++y)
+        {
+            auto row = current + y * width;
+            auto above = row - width;
+            auto out = residual + y * width;
+            auto top = y == 0 || (restartRows != 0 && y % restartRows == 0);
+            for (size_t x = 0; x < width; ++x)
+            {
+                uint16_t predicted = 0;
+                if (!top && x != 0)
+                {
+                    predicted = PredictMed(row[x - 1] >> internalShift, above[x] >> internalShift, above[x - 1] >> internalShift);
+                }
+                else if (!top)
+                {
+                    predicted = above[x] >> internalShift;
+                }
+                else if (x != 0)
+                {
+                    predicted = row[x - 1] >> internalShift;
+                }
+                auto value = static_cast<uint16_t>((row[x] >> internalShift) - predicted + bias) & mask;
+                out[x] = static_cast<uint16_t>(value << internalShift);
+            }
+        }
+    }
+
+    //inverse of ToMedResidual, works in place
+    inline void FromMedResidual(const uint16_t *residual, uint16_t *current, const size_t width, const size_t height,
+                                const int internalShift, const size_t restartRows = 0)
+    {
+        const auto mask = static_cast<uint16_t>(0xFFFF >> internalShift);
+        const auto bias = ResidualBias(internalShift);
+        for (size_t y = 0; y < height; ++y)
+        {
+            auto in = residual + y * width;
+            auto row = current + y * width;
+            auto above = row - width;
+            auto top = y == 0 || (restartRows != 0 && y % restartRows == 0);
+            for (size_t x = 0; x < width; ++x)
+            {
+                uint16_t predicted = 0;
+                if (!top && x != 0)
+                {
+                    predicted = PredictMed(row[x - 1] >> internalShift, above[x] >> internalShift, above[x - 1] >> internalShift);
+                }
+                else if (!top)
+                {
+                    predicted = above[x] >> internalShift;
+                }
+                else if (x != 0)
+                {
+                    predicted = row[x - 1] >> internalShift;
+                }
+                auto value = static_cast<uint16_t>((in[x] >> internalShift) + predicted - bias) & mask;
+                row[x] = static_cast<uint16_t>(value << internalShift);
+            }
+        }
+    }
+
+    inline void StoreLittleEndian(uint8_t *bytes, const uint64_t value, const int count)
+    {
+        for (auto i = 0; i < count; ++i)
+        {
+            bytes[i] = static_cast<uint8_t>(value >> (i * 8));
+        }
+    }
+
+    inline uint64_t LoadLittleEndian(const uint8_t *bytes, const int count)
+    {
+        uint64_t value = 0;
+        for (auto i = 0; i < count; ++i)
+        {
+            value |= static_cast<uint64_t>(bytes[i]) << (i * 8);
+        }
+        return value;
+    }
+
+    //calls function(std::integral_constant<int, internalShift>()), so that callers can pick a template by a runtime shift
+    template <class Function, int... shifts>
+    void DispatchShift(const int internalShift, Function &&function, std::integer_sequence<int, shifts...>)
+    {
+        if (internalShift < 1 || internalShift > MaxShift)
+        {
+            throw std::invalid_argument("qoi15: unsupported shift");
+        }
+        (void)((internalShift == shifts + 1 ? (function(std::integral_constant<int, shifts + 1>()), true) : false) || ...);
+    }
+
+    template <class Function>
+    void DispatchShift(const int internalShift, Function &&function)
+    {
+        DispatchShift(internalShift, std::forward<Function>(function), std::make_integer_sequence<int, MaxShift>());
+    }
+
+    //fixed 40 byte little endian header in front of the encoded words
+    struct FileHeader
+    {
+        static constexpr uint32_t Magic = 0x35314F51; //"QO15"
+        static constexpr uint8_t Version = 1;
+        static constexpr int Size = 40;
+        static constexpr uint8_t ChecksumFlag = 0x01;
+        //a footer of restart points follows the words
+        static constexpr uint8_t IndexFlag = 0x02;
+        //the words hold ToTemporalResidual() against a reference frame
+        static constexpr uint8_t TemporalFlag = 0x04;
+        //the words hold ToMedResidual() restarted at every indexRows rows
+        static constexpr uint8_t MedFlag = 0x08;
+        //PackLowBits() of the pixels follows the index, then its checksum if the file has one
+        static constexpr uint8_t LowBitsFlag = 0x10;
+        //the codec counts pixels and words in int
+        static constexpr uint64_t MaxCount = static_cast<uint64_t>(std::numeric_limits<int>::max());
+
+        uint8_t version = Version;
+        uint8_t shift = 1;
+        Layout layout = DefaultLayout;
+        uint8_t flags = 0;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t checksum = 0;
+        uint32_t indexRows = 0;
+        uint64_t pixels = 0;
+        uint64_t words = 0;
+
+        bool HasChecksum() const
+        {
+            return (flags & ChecksumFlag) != 0;
+        }
+
+        bool HasIndex() const
+        {
+            return (flags & IndexFlag) != 0;
+        }
+
+        bool IsTemporal() const
+        {
+            return (flags & TemporalFlag) != 0;
+        }
+
+        bool IsMed() const
+        {
+            return (flags & MedFlag) != 0;
+        }
+
+        bool HasLowBits() const
+        {
+            return (flags & LowBitsFlag) != 0;
+        }
+
+        uint64_t GetLowBitsSize() const
+        {
+            return HasLowBits() ? LowBitsSize(static_cast<size_t>(pixels), shift) : 0;
+        }
+
+        //undoes the prediction of width * rows pixels starting at a restart row, in place
+        void Reconstruct(uint16_t *pixels, const uint32_t rows, const uint16_t *reference) const
+        {
+            if (IsTemporal())
+            {
+                FromTemporalResidual(pixels, reference, pixels, static_cast<size_t>(width) * rows, shift);
+            }
+            else if (IsMed())
+            {
+                FromMedResidual(pixels, pixels, width, rows, shift, indexRows);
+            }
+        }
+
+        //one restart point in front of every indexRows rows
+        uint64_t GetIndexSize() const
+        {
+            return HasIndex() && pixels != 0 ? (height + indexRows - 1) / indexRows : 0;
+        }
+
+        void Store(uint8_t *bytes) const
+        {
+            StoreLittleEndian(bytes + 0, Magic, 4);
+            StoreLittleEndian(bytes + 4, version, 1);
+            StoreLittleEndian(bytes + 5, shift, 1);
+            StoreLittleEndian(bytes + 6, static_cast<uint8_t>(layout), 1);
+            StoreLittleEndian(bytes + 7, flags, 1);
+            StoreLittleEndian(bytes + 8, width, 4);
+            StoreLittleEndian(bytes + 12, height, 4);
+            StoreLittleEndian(bytes + 16, checksum, 4);
+            StoreLittleEndian(bytes + 20, indexRows, 4);
+            StoreLittleEndian(bytes + 24, pixels, 8);
+            StoreLittleEndian(bytes + 32, words, 8);
+        }
+
+        //throws std::runtime_error for anything this build cannot decode
+        void Load(const uint8_t *bytes)
+        {
+            if (LoadLittleEndian(bytes + 0, 4) != Magic)
+            {
+                throw std::runtime_error("qoi15: not a qoi15 file");
+            }
+            version = static_cast<uint8_t>(LoadLittleEndian(bytes + 4, 1));
+            shift = static_cast<uint8_t>(LoadLittleEndian(bytes + 5, 1));
+            layout = static_cast<Layout>(LoadLittleEndian(bytes + 6, 1));
+            flags = static_cast<uint8_t>(LoadLittleEndian(bytes + 7, 1));
+            width = static_cast<uint32_t>(LoadLittleEndian(bytes + 8, 4));
+            height = static_cast<uint32_t>(LoadLittleEndian(bytes + 12, 4));
+            checksum = static_cast<uint32_t>(LoadLittleEndian(bytes + 16, 4));
+            indexRows = static_cast<uint32_t>(LoadLittleEndian(bytes + 20, 4));
+            pixels = LoadLittleEndian(bytes + 24, 8);
+            words = LoadLittleEndian(bytes + 32, 8);
+
+            if (version != Version)
+            {
+                throw std::runtime_error("qoi15: unsupported file version");
+            }
+            if (shift > MaxShift)
+            {
+                throw std::runtime_error("qoi15: unsupported shift");
+            }
+            if (layout != DefaultLayout && layout != Layout::RowCopy)
+            {
+                throw std::runtime_error("qoi15: token layout differs from this build");
+            }
+            //a lossless payload is two streams, which neither restart points nor row copies can span
+            if (pixels != static_cast<uint64_t>(width) * height || pixels > MaxCount || words > MaxCount || words > MaxEncodedSize(pixels, shift) ||
+                (HasIndex() && indexRows == 0) ||
+                (IsTemporal() && IsMed()) || (HasIndex() && layout == Layout::RowCopy) ||
+                (shift == LosslessShift && (HasIndex() || layout == Layout::RowCopy || HasLowBits())))
+            {
+                throw std::runtime_error("qoi15: inconsistent header");
+            }
+        }
+    };
+
+    //decodes the words of a file with the shift and the layout of its header, returns the number of pixels written
+    inline size_t DecodeFile(const FileHeader &header, const uint16_t *words, uint16_t *out)
+    {
+        if (header.pixels > FileHeader::MaxCount || header.words > FileHeader::MaxCount)
+        {
+            throw std::runtime_error("qoi15: inconsistent header");
+        }
+        if (header.layout != Layout::RowCopy)
+        {
+            return DecodeInto(header.shift, words, static_cast<size_t>(header.words), out, static_cast<size_t>(header.pixels));
+        }
+
+        size_t written = 0;
+        DispatchShift(header.shift, [&](auto shift)
+                      {
+                          QOI15Decoder<decltype(shift)::value, SpeedFirstRepository, Layout::RowCopy> decoder;
+                          decoder.SetWidth(static_cast<int>(header.width));
+                          decoder.Decode(words, static_cast<int>(header.words), out, static_cast<int>(header.pixels));
+                          written = static_cast<size_t>(std::get<1>(decoder.Get()));
+                      });
+        return written;
+    }
+
+    //restart point as stored in the index footer, 52 bytes
+    struct FileIndexEntry
+    {
+        static constexpr int Size = 20 + RestartPoint::MaxTableSize * 2;
+
+        static void Store(uint8_t *bytes, const RestartPoint &point)
+        {
+            StoreLittleEndian(bytes + 0, point.wordOffset, 8);
+            StoreLittleEndian(bytes + 8, point.pixelOffset, 8);
+            StoreLittleEndian(bytes + 16, point.valueIndex, 1);
+            StoreLittleEndian(bytes + 17, 0, 1);
+            StoreLittleEndian(bytes + 18, point.previous, 2);
+            for (auto i = 0; i < RestartPoint::MaxTableSize; ++i)
+            {
+                StoreLittleEndian(bytes + 20 + i * 2, point.table[i], 2);
+            }
+        }
+
+        static RestartPoint Load(const uint8_t *bytes)
+        {
+            RestartPoint point;
+            point.wordOffset = LoadLittleEndian(bytes + 0, 8);
+            point.pixelOffset = LoadLittleEndian(bytes + 8, 8);
+            point.valueIndex = static_cast<uint8_t>(LoadLittleEndian(bytes + 16, 1));
+            point.previous = static_cast<uint16_t>(LoadLittleEndian(bytes + 18, 2));
+            for (auto i = 0; i < RestartPoint::MaxTableSize; ++i)
+            {
+                point.table[i] = static_cast<uint16_t>(LoadLittleEndian(bytes + 20 + i * 2, 2));
+            }
+            return point;
+        }
+    };
+
+    //words go to the stream as little endian bytes through a fixed staging buffer
+    class FileWriter
+    {
+        std::ostream &stream_;
+        bool checksum_;
+        int indexRows_;
+        Prediction prediction_;
+        Layout layout_;
+        bool lowBits_;
+        std::vector<uint16_t> encoded_;
+        std::vector<RestartPoint> points_;
+        std::vector<uint16_t> residual_;
+        std::array<uint8_t, 16384> bytes_;
+
+        //before anything is read from the pixels
+        void CheckFrame(const uint32_t width, const uint32_t height, const int internalShift)
+        {
+            if (internalShift < LosslessShift || internalShift > MaxShift ||
+                (internalShift == LosslessShift && (indexRows_ > 0 || layout_ == Layout::RowCopy)))
+            {
+                throw std::invalid_argument("qoi15: unsupported shift");
+            }
+            if (MaxEncodedSize(static_cast<size_t>(width) * height, internalShift) > FileHeader::MaxCount)
+            {
+                throw std::invalid_argument("qoi15: image too large");
+            }
+        }
+
+        //original is the frame before the prediction, which the low bits are taken from
+        size_t WriteFrame(const uint16_t *pixels, const uint32_t width, const uint32_t height, const int internalShift, const uint8_t flags,
+                          const uint16_t *original)
+        {
+            FileHeader header;
+            header.shift = static_cast<uint8_t>(internalShift);
+            header.flags = flags | (checksum_ ? FileHeader::ChecksumFlag : 0) | (indexRows_ > 0 ? FileHeader::IndexFlag : 0) |
+                           (lowBits_ && internalShift != LosslessShift ? FileHeader::LowBitsFlag : 0);
+            header.width = width;
+            header.height = height;
+            header.indexRows = indexRows_ > 0 ? static_cast<uint32_t>(indexRows_) : 0;
+            header.layout = layout_;
+            header.pixels = static_cast<uint64_t>(width) * height;
+
+            encoded_.resize(MaxEncodedSize(header.pixels, internalShift));
+            if (internalShift == LosslessShift)
+            {
+                header.words = EncodeInto<LosslessShift>(pixels, static_cast<size_t>(header.pixels), encoded_.data(), encoded_.size());
+            }
+            else
+            {
+                DispatchShift(internalShift, [&](auto shift)
+                              {
+                                  if (layout_ == Layout::RowCopy)
+                                  {
+                                      QOI15Encoder<decltype(shift)::value, SpeedFirstRepository, Layout::RowCopy> encoder;
+                                      encoder.SetWidth(static_cast<int>(width));
+                                      encoder.Encode(pixels, static_cast<int>(header.pixels), encoded_.data());
+                                      header.words = static_cast<uint64_t>(std::get<1>(encoder.Get()));
+                                      return;
+                                  }
+                                  QOI15Encoder<decltype(shift)::value> encoder;
+                                  if (header.HasIndex())
+                                  {
+                                      encoder.Encode(pixels, static_cast<int>(header.pixels), encoded_.data(), indexRows_ * static_cast<int>(width), points_);
+                                  }
+                                  else
+                                  {
+                                      encoder.Encode(pixels, static_cast<int>(header.pixels), encoded_.data());
+                                  }
+                                  header.words = static_cast<uint64_t>(std::get<1>(encoder.Get()));
+                              });
+            }
+
+            //two passes over the staging buffer keep the writer usable on pipes, no seeking back to patch the header
+            auto stage = [&](const uint64_t i, const uint64_t size)
+            {
+                auto count = std::min<uint64_t>(size - i, bytes_.size() / 2);
+                for (uint64_t j = 0; j < count; ++j)
+                {
+                    bytes_[j * 2 + 0] = static_cast<uint8_t>(encoded_[i + j]);
+                    bytes_[j * 2 + 1] = static_cast<uint8_t>(encoded_[i + j] >> 8);
+                }
+                return count;
+            };
+            if (checksum_)
+            {
+                for (uint64_t i = 0; i < header.words;)
+                {
+                    auto count = stage(i, header.words);
+                    header.checksum = Crc32c(bytes_.data(), count * 2, header.checksum);
+                    i += count;
+                }
+            }
+
+            header.Store(bytes_.data());
+            stream_.write(reinterpret_cast<const char *>(bytes_.data()), FileHeader::Size);
+            for (uint64_t i = 0; i < header.words;)
+            {
+                auto count = stage(i, header.words);
+                stream_.write(reinterpret_cast<const char *>(bytes_.data()), count * 2);
+                i += count;
+            }
+
+            auto indexSize = header.GetIndexSize();
+            for (uint64_t i = 0; i < indexSize; ++i)
+            {
+                FileIndexEntry::Store(bytes_.data(), points_[i]);
+                stream_.write(reinterpret_cast<const char *>(bytes_.data()), FileIndexEntry::Size);
+            }
+
+            //last, so that readers of the shifted image never have to skip them
+            auto lowBitsSize = header.GetLowBitsSize();
+            if (lowBitsSize != 0)
+            {
+                encoded_.resize(lowBitsSize);
+                PackLowBits(original, static_cast<size_t>(header.pixels), encoded_.data(), internalShift);
+                uint32_t crc = 0;
+                for (uint64_t i = 0; i < lowBitsSize;)
+                {
+                    auto count = stage(i, lowBitsSize);
+                    if (checksum_)
+                    {
+                        crc = Crc32c(bytes_.data(), count * 2, crc);
+                    }
+                    stream_.write(reinterpret_cast<const char *>(bytes_.data()), count * 2);
+                    i += count;
+                }
+                if (checksum_)
+                {
+                    StoreLittleEndian(bytes_.data(), crc, 4);
+                    stream_.write(reinterpret_cast<const char *>(bytes_.data()), 4);
+                }
+            }
+
+            if (!stream_)
+            {
+                throw std::runtime_error("qoi15: failed to write the file");
+            }
+            return FileHeader::Size + static_cast<size_t>(header.words) * 2 + static_cast<size_t>(indexSize) * FileIndexEntry::Size +
+                   static_cast<size_t>(lowBitsSize) * 2 + (lowBitsSize != 0 && checksum_ ? 4 : 0);
+        }
+
+    public:
+        //indexRows > 0 adds a restart point every indexRows rows for ReadRows(), which the row copy layout cannot have,
+        //lowBits keeps the bits below the shift for ReadExact()
+        explicit FileWriter(std::ostream &stream, const bool checksum = true, const int indexRows = 0, const Prediction prediction = Prediction::None,
+                            const Layout layout = DefaultLayout, const bool lowBits = false)
+            : stream_(stream), checksum_(checksum), indexRows_(indexRows), prediction_(prediction), layout_(layout), lowBits_(lowBits)
+        {
+            if ((layout_ != DefaultLayout && layout_ != Layout::RowCopy) || (layout_ == Layout::RowCopy && indexRows_ > 0))
+            {
+                throw std::invalid_argument("qoi15: unsupported layout");
+            }
+        }
+
+        //returns the number of bytes written, LosslessShift keeps all 16bit but cannot have a row index or the row copy layout
+        size_t Write(const uint16_t *pixels, const uint32_t width, const uint32_t height, const int internalShift = 1)
+        {
+            CheckFrame(width, height, internalShift);
+            if (prediction_ == Prediction::Med)
+            {
+                residual_.resize(static_cast<size_t>(width) * height);
+                ToMedResidual(pixels, residual_.data(), width, height, internalShift, indexRows_ > 0 ? indexRows_ : 0);
+                return WriteFrame(residual_.data(), width, height, internalShift, FileHeader::MedFlag, pixels);
+            }
+            return WriteFrame(pixels, width, height, internalShift, 0, pixels);
+        }
+
+        //stores the difference to reference, which replaces the spatial prediction, a frame of the same size that the reader has to provide as well
+        size_t Write(const uint16_t *pixels, const uint32_t width, const uint32_t height, const int internalShift, const uint16_t *reference)
+        {
+            CheckFrame(width, height, internalShift);
+            residual_.resize(static_cast<size_t>(width) * height);
+            ToTemporalResidual(pixels, reference, residual_.data(), residual_.size(), internalShift);
+            return WriteFrame(residual_.data(), width, height, internalShift, FileHeader::TemporalFlag, pixels);
+        }
+    };
+
+    //reads the header up front so the caller can size the output from it
+    class FileReader
+    {
+        std::istream &stream_;
+        FileHeader header_;
+        std::streampos payload_;
+        std::vector<uint16_t> encoded_;
+        std::vector<RestartPoint> points_;
+        std::vector<uint16_t> rows_;
+        std::array<uint8_t, 16384> bytes_;
+
+        //words [begin, end) of the payload from the current stream position, checksum is only known for the whole payload
+        void ReadWords(const uint64_t begin, const uint64_t end, uint32_t *crc)
+        {
+            encoded_.resize(end - begin);
+            for (auto i = begin; i < end;)
+            {
+                auto count = std::min<uint64_t>(end - i, bytes_.size() / 2);
+                if (!stream_.read(reinterpret_cast<char *>(bytes_.data()), count * 2))
+                {
+                    throw std::runtime_error("qoi15: truncated file");
+                }
+                if (crc != nullptr)
+                {
+                    *crc = Crc32c(bytes_.data(), count * 2, *crc);
+                }
+                for (uint64_t j = 0; j < count; ++j)
+                {
+                    encoded_[i - begin + j] = static_cast<uint16_t>(bytes_[j * 2 + 0] | (bytes_[j * 2 + 1] << 8));
+                }
+                i += count;
+            }
+        }
+
+        void LoadIndex()
+        {
+            if (!points_.empty() || header_.GetIndexSize() == 0)
+            {
+                return;
+            }
+            stream_.clear();
+            stream_.seekg(payload_ + static_cast<std::streamoff>(header_.words * 2));
+
+            auto rowPixels = static_cast<uint64_t>(header_.indexRows) * header_.width;
+            for (uint64_t i = 0; i < header_.GetIndexSize(); ++i)
+            {
+                if (!stream_.read(reinterpret_cast<char *>(bytes_.data()), FileIndexEntry::Size))
+                {
+                    throw std::runtime_error("qoi15: truncated row index");
+                }
+                auto point = FileIndexEntry::Load(bytes_.data());
+                if (point.wordOffset > header_.words || point.pixelOffset > i * rowPixels || point.valueIndex > 2 ||
+                    (i > 0 && (point.wordOffset < points_.back().wordOffset || point.pixelOffset < points_.back().pixelOffset)))
+                {
+                    throw std::runtime_error("qoi15: inconsistent row index");
+                }
+                points_.push_back(point);
+            }
+        }
+
+    public:
+        explicit FileReader(std::istream &stream)
+            : stream_(stream)
+        {
+            if (!stream_.read(reinterpret_cast<char *>(bytes_.data()), FileHeader::Size))
+            {
+                throw std::runtime_error("qoi15: truncated file header");
+            }
+            header_.Load(bytes_.data());
+            payload_ = stream_.tellg();
+        }
+
+        const FileHeader &GetHeader() const
+        {
+            return header_;
+        }
+
+        //returns the number of pixels written into out, temporal frames need the reference they were written with
+        size_t Read(uint16_t *out, const size_t outCapacity, const uint16_t *reference = nullptr)
+        {
+            if (outCapacity < header_.pixels)
+            {
+                throw std::length_error("qoi15: output capacity is smaller than the image");
+            }
+            if (header_.IsTemporal() && reference == nullptr)
+            {
+                throw std::invalid_argument("qoi15: temporal frame needs its reference frame");
+            }
+
+            //ReadRows() may have moved the stream, pipes cannot and report -1
+            if (payload_ != std::streampos(-1))
+            {
+                stream_.clear();
+                stream_.seekg(payload_);
+            }
+            uint32_t crc = 0;
+            ReadWords(0, header_.words, header_.HasChecksum() ? &crc : nullptr);
+            if (header_.HasChecksum() && crc != header_.checksum)
+            {
+                throw std::runtime_error("qoi15: checksum mismatch");
+            }
+
+            auto written = DecodeFile(header_, encoded_.data(), out);
+            if (written != header_.pixels)
+            {
+                throw std::runtime_error("qoi15: stream ends before the image");
+            }
+            header_.Reconstruct(out, header_.height, reference);
+            return written;
+        }
+
+        std::vector<uint16_t> Read(const uint16_t *reference = nullptr)
+        {
+            std::vector<uint16_t> pixels(header_.pixels);
+            Read(pixels.data(), pixels.size(), reference);
+            return pixels;
+        }
+
+        //Read() with the bits below the shift merged back, the file must have been written with low bits
+        size_t ReadExact(uint16_t *out, const size_t outCapacity, const uint16_t *reference = nullptr)
+        {
+            if (!header_.HasLowBits())
+            {
+                throw std::runtime_error("qoi15: file has no low bits");
+            }
+            auto written = Read(out, outCapacity, reference);
+
+            //Read() stops right after the words
+            stream_.ignore(static_cast<std::streamsize>(header_.GetIndexSize() * FileIndexEntry::Size));
+            uint32_t crc = 0;
+            ReadWords(0, header_.GetLowBitsSize(), header_.HasChecksum() ? &crc : nullptr);
+            if (header_.HasChecksum())
+            {
+                if (!stream_.read(reinterpret_cast<char *>(bytes_.data()), 4))
+                {
+                    throw std::runtime_error("qoi15: truncated file");
+                }
+                if (crc != static_cast<uint32_t>(LoadLittleEndian(bytes_.data(), 4)))
+                {
+                    throw std::runtime_error("qoi15: checksum mismatch");
+                }
+            }
+            UnpackLowBits(encoded_.data(), encoded_.size(), out, written, header_.shift);
+            return written;
+        }
+
+        std::vector<uint16_t> ReadExact(const uint16_t *reference = nullptr)
+        {
+            std::vector<uint16_t> pixels(header_.pixels);
+            ReadExact(pixels.data(), pixels.size(), reference);
+            return pixels;
+        }
+
+        //decodes rows [y0, y1) from the nearest restart point, the stream must be seekable and the file written with an index,
+        //reference is the whole reference frame for temporal frames
+        size_t ReadRows(const uint32_t y0, const uint32_t y1, uint16_t *out, const size_t outCapacity, const uint16_t *reference = nullptr)
+        {
+            if (header_.IsTemporal() && reference == nullptr)
+            {
+                throw std::invalid_argument("qoi15: temporal frame needs its reference frame");
+            }
+            if (!header_.HasIndex())
+            {
+                throw std::runtime_error("qoi15: file has no row index");
+            }
+            if (y0 > y1 || y1 > header_.height)
+            {
+                throw std::invalid_argument("qoi15: rows are outside the image");
+            }
+            auto begin = static_cast<uint64_t>(y0) * header_.width;
+            auto end = static_cast<uint64_t>(y1) * header_.width;
+            if (outCapacity < end - begin)
+            {
+                throw std::length_error("qoi15: output capacity is smaller than the rows");
+            }
+            if (begin == end)
+            {
+                return 0;
+            }
+            LoadIndex();
+
+            //the tokens of pixels before a point end in the word it points at,
+            //a run crossing y1 moves the point back, so look for one at or after the last pixel
+            auto first = y0 / header_.indexRows;
+            auto last = (y1 + header_.indexRows - 1) / header_.indexRows;
+            while (last < points_.size() && points_[last].pixelOffset < end)
+            {
+                last++;
+            }
+            auto point = points_[first];
+            auto wordEnd = last < points_.size() ? std::min(points_[last].wordOffset + 1, header_.words) : header_.words;
+
+            stream_.clear();
+            stream_.seekg(payload_ + static_cast<std::streamoff>(point.wordOffset * 2));
+            ReadWords(point.wordOffset, wordEnd, nullptr);
+
+            rows_.resize(end - point.pixelOffset);
+            auto written = static_cast<uint64_t>(0);
+            point.wordOffset = 0;
+            DispatchShift(header_.shift, [&](auto shift)
+                          {
+                              QOI15Decoder<decltype(shift)::value> decoder;
+                              decoder.Decode(encoded_.data(), static_cast<int>(encoded_.size()), point, rows_.data(), static_cast<int>(rows_.size()));
+                              written = static_cast<uint64_t>(std::get<1>(decoder.Get()));
+                          });
+            if (written != rows_.size())
+            {
+                throw std::runtime_error("qoi15: stream ends before the rows");
+            }
+            //the spatial prediction restarts at the row of the first point
+            auto restart = static_cast<uint64_t>(first) * header_.indexRows * header_.width;
+            if (header_.IsMed())
+            {
+                header_.Reconstruct(rows_.data() + (restart - point.pixelOffset), y1 - first * header_.indexRows, nullptr);
+            }
+            std::copy(rows_.begin() + static_cast<std::ptrdiff_t>(begin - point.pixelOffset), rows_.end(), out);
+            if (header_.IsTemporal())
+            {
+                FromTemporalResidual(out, reference + begin, out, static_cast<size_t>(end - begin), header_.shift);
+            }
+            return static_cast<size_t>(end - begin);
+        }
+    };
+
+    //encodes a frame that arrives a few rows at a time, e.g. from a line scan camera,
+    //words reach the sink by the end of the PushRows() call that completed them
+    template <int internalShift = 1>
+    class StreamEncoder
+    {
+        static_assert(internalShift > 0 && internalShift <= MaxShift, "shift must be 1 to MaxShift");
+
+        QOI15Encoder<internalShift, CallbackRepository> encoder_;
+        int width_;
+
+    public:
+        StreamEncoder(const int width, CallbackRepository::Sink sink)
+            : width_(width)
+        {
+            encoder_.GetRepository().SetSink(std::move(sink));
+            encoder_.Reset();
+        }
+
+        //stride is the distance between row starts in pixels
+        void PushRows(const uint16_t *rows, const int count, const size_t stride)
+        {
+            for (auto y = 0; y < count; ++y)
+            {
+                encoder_.Push(rows + y * stride, width_);
+            }
+            encoder_.GetRepository().Emit();
+        }
+
+        //ends the frame, the next PushRows() starts a new one, returns the number of words of the frame
+        size_t Finish()
+        {
+            encoder_.Finish();
+            auto &repository = encoder_.GetRepository();
+            repository.Emit();
+            auto size = static_cast<size_t>(repository.GetSize());
+            encoder_.Reset();
+            return size;
+        }
+    };
+
+    struct StreamDecodeResult
+    {
+        size_t consumed;
+        size_t produced;
+        bool done;
+    };
+
+    //decodes little endian stream bytes fed in any chunks, suspends when the input or the output runs out
+    template <int internalShift = 1>
+    class StreamDecoder
+    {
+        static_assert(internalShift > 0 && internalShift <= MaxShift, "shift must be 1 to MaxShift");
+
+        using Config = CodecConfig<internalShift>;
+        using WordTableType = typename Config::WordTableType;
+
+        typename Config::BitShifterType bitShifter_;
+        typename Config::RunLengthType runLength_;
+        typename Config::DifferentialType differential_;
+        typename Config::TableType table_;
+        typename Config::RawType raw_;
+
+        uint64_t pixels_;
+        uint64_t produced_;
+        uint16_t previous_;
+
+        //run chunks seen so far, and pixels of a finished run that did not fit into the output yet
+        uint32_t runValue_;
+        int runShift_;
+        uint64_t fill_;
+
+        //word being decoded, valueIndex_ is 3 once it is used up
+        uint16_t word_;
+        int valueIndex_;
+
+        //first byte of a word split between two chunks
+        uint8_t oddByte_;
+        bool hasOddByte_;
+
+        void EndRun()
+        {
+            fill_ = std::min<uint64_t>(runValue_, pixels_ - produced_);
+            runValue_ = 0;
+            runShift_ = 0;
+        }
+
+    public:
+        //pixels comes from the container, e.g. FileHeader::pixels
+        explicit StreamDecoder(const uint64_t pixels = 0)
+        {
+            Reset(pixels);
+        }
+
+        void Reset(const uint64_t pixels)
+        {
+            table_.Reset();
+            pixels_ = pixels;
+            produced_ = 0;
+            previous_ = 0xFFFF;
+            runValue_ = 0;
+            runShift_ = 0;
+            fill_ = 0;
+            word_ = 0;
+            valueIndex_ = 3;
+            oddByte_ = 0;
+            hasOddByte_ = false;
+        }
+
+        bool IsDone() const
+        {
+            return produced_ == pixels_;
+        }
+
+        //bytes after the last pixel are left unconsumed
+        StreamDecodeResult Decode(const uint8_t *input, const size_t inputSize, uint16_t *out, const size_t outCapacity)
+        {
+            const auto &wordTable = WordTableType::Instance();
+
+            size_t consumed = 0;
+            size_t produced = 0;
+
+            while (true)
+            {
+                if (fill_ != 0)
+                {
+                    auto count = std::min<uint64_t>(fill_, outCapacity - produced);
+                    FillWords(out + produced, bitShifter_.Set(previous_), static_cast<int>(count));
+                    produced += static_cast<size_t>(count);
+                    produced_ += count;
+                    fill_ -= count;
+                    if (fill_ != 0)
+                    {
+                        break;
+                    }
+                }
+                if (produced_ == pixels_)
+                {
+                    break;
+                }
+
+                if (valueIndex_ == 3)
+                {
+                    if (inputSize - consumed + (hasOddByte_ ? 1 : 0) < 2)
+                    {
+                        if (consumed < inputSize)
+                        {
+                            oddByte_ = input[consumed++];
+                            hasOddByte_ = true;
+                        }
+                        break;
+                    }
+                    uint8_t low = hasOddByte_ ? oddByte_ : input[consumed++];
+                    word_ = static_cast<uint16_t>(low | (input[consumed++] << 8));
+                    hasOddByte_ = false;
+                    valueIndex_ = 0;
+
+                    //three diffs in one go when nothing else is pending
+                    auto actions = wordTable.Get(word_);
+                    if (!raw_.IsValid(word_) && (actions & WordTableType::AllDiffFlag) != 0 && runShift_ == 0 &&
+                        outCapacity - produced >= 3 && pixels_ - produced_ >= 3)
+                    {
+                        for (auto i = 0; i < 3; ++i, actions >>= 8)
+                        {
+                            previous_ = differential_.Add(previous_, static_cast<int32_t>(actions & WordTableType::OperandMask) - WordTableType::DiffBias);
+                            out[produced++] = bitShifter_.Set(previous_);
+                        }
+                        produced_ += 3;
+                        valueIndex_ = 3;
+                        continue;
+                    }
+                }
+
+                if (raw_.IsValid(word_))
+                {
+                    if (runShift_ != 0)
+                    {
+                        EndRun();
+                        continue;
+                    }
+                    if (produced == outCapacity)
+                    {
+                        break;
+                    }
+                    auto current = raw_.Set(word_);
+                    table_.Insert(table_.Hash(current), current);
+                    out[produced++] = bitShifter_.Set(current);
+                    produced_++;
+                    previous_ = current;
+                    valueIndex_ = 3;
+                    continue;
+                }
+
+                auto action = static_cast<uint8_t>(wordTable.Get(word_) >> (valueIndex_ * 8));
+                auto operand = action & WordTableType::OperandMask;
+                auto kind = action & WordTableType::KindMask;
+
+                if (kind == WordTableType::RunAction)
+                {
+                    //padding values beyond int range carry no length
+                    if (runShift_ < 32)
+                    {
+                        runValue_ |= static_cast<uint32_t>(operand) << runShift_;
+                    }
+                    runShift_ += decltype(runLength_)::ValueBit;
+                    valueIndex_++;
+                    //the last run of the image ends with the image, not with the next token
+                    if (produced_ + runValue_ >= pixels_)
+                    {
+                        EndRun();
+                    }
+                    continue;
+                }
+
+                if (runShift_ != 0)
+                {
+                    EndRun();
+                    continue;
+                }
+                if (produced == outCapacity)
+                {
+                    break;
+                }
+
+                if (kind == WordTableType::DiffAction)
+                {
+                    previous_ = differential_.Add(previous_, operand - WordTableType::DiffBias);
+                }
+                else
+                {
+                    previous_ = table_.Refer(static_cast<uint8_t>(operand));
+                }
+                out[produced++] = bitShifter_.Set(previous_);
+                produced_++;
+                valueIndex_++;
+            }
+
+            return {consumed, produced, produced_ == pixels_};
+        }
+    };
+
+    //one frame of a sequence, the frame itself is a complete qoi15 file at offset
+    struct SequenceEntry
+    {
+        static constexpr int Size = 32;
+
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        //caller defined, e.g. nanoseconds since the start of the acquisition
+        uint64_t timestamp = 0;
+        uint32_t flags = 0;
+        //predicted from the frame before it, decoding starts at the last key frame
+        bool temporal = false;
+
+        void Store(uint8_t *bytes) const
+        {
+            StoreLittleEndian(bytes + 0, offset, 8);
+            StoreLittleEndian(bytes + 8, size, 8);
+            StoreLittleEndian(bytes + 16, timestamp, 8);
+            StoreLittleEndian(bytes + 24, flags, 4);
+            StoreLittleEndian(bytes + 28, temporal ? 1 : 0, 1);
+            StoreLittleEndian(bytes + 29, 0, 3);
+        }
+
+        void Load(const uint8_t *bytes)
+        {
+            offset = LoadLittleEndian(bytes + 0, 8);
+            size = LoadLittleEndian(bytes + 8, 8);
+            timestamp = LoadLittleEndian(bytes + 16, 8);
+            flags = static_cast<uint32_t>(LoadLittleEndian(bytes + 24, 4));
+            temporal = LoadLittleEndian(bytes + 28, 1) != 0;
+        }
+    };
+
+    //[16 byte header] then frames back to back, every flush puts [index entries of all frames][24 byte footer] behind them,
+    //all little endian, the footer at the end of the file is the current one
+    struct SequenceLayout
+    {
+        static constexpr uint32_t Magic = 0x53353151; //"Q15S"
+        static constexpr uint8_t Version = 1;
+        static constexpr int HeaderSize = 16;
+        static constexpr int FooterSize = 24;
+
+        //what LoadIndex() found, end is where the next frame goes
+        struct Index
+        {
+            std::vector<SequenceEntry> entries;
+            uint64_t end = HeaderSize;
+            //the file ends with the index of all its frames
+            bool closed = false;
+        };
+
+        static void StoreHeader(uint8_t *bytes)
+        {
+            std::fill(bytes, bytes + HeaderSize, static_cast<uint8_t>(0));
+            StoreLittleEndian(bytes + 0, Magic, 4);
+            StoreLittleEndian(bytes + 4, Version, 1);
+        }
+
+        static void LoadHeader(const uint8_t *bytes)
+        {
+            if (LoadLittleEndian(bytes + 0, 4) != Magic)
+            {
+                throw std::runtime_error("qoi15: not a qoi15 sequence");
+            }
+            if (LoadLittleEndian(bytes + 4, 1) != Version)
+            {
+                throw std::runtime_error("qoi15: unsupported sequence version");
+            }
+        }
+
+        static void StoreFooter(uint8_t *bytes, const uint64_t indexOffset, const uint64_t count)
+        {
+            StoreLittleEndian(bytes + 0, indexOffset, 8);
+            StoreLittleEndian(bytes + 8, count, 8);
+            StoreLittleEndian(bytes + 16, Magic, 4);
+            StoreLittleEndian(bytes + 20, 0, 4);
+        }
+
+        //bytes of the qoi15 file a frame is stored as
+        static uint64_t FrameSize(const FileHeader &header)
+        {
+            auto lowBitsSize = header.GetLowBitsSize();
+            return FileHeader::Size + header.words * 2 + header.GetIndexSize() * FileIndexEntry::Size + lowBitsSize * 2 +
+                   (lowBitsSize != 0 && header.HasChecksum() ? 4 : 0);
+        }
+
+        //true if the index of count frames and its footer start at indexOffset and end within size
+        static bool HasIndex(std::istream &stream, const uint64_t indexOffset, const uint64_t count, const uint64_t size)
+        {
+            std::array<uint8_t, FooterSize> bytes;
+            auto footer = indexOffset + count * SequenceEntry::Size;
+            if (footer + FooterSize > size)
+            {
+                return false;
+            }
+            stream.clear();
+            stream.seekg(static_cast<std::streamoff>(footer));
+            return stream.read(reinterpret_cast<char *>(bytes.data()), FooterSize) && LoadLittleEndian(bytes.data() + 0, 8) == indexOffset &&
+                   LoadLittleEndian(bytes.data() + 8, 8) == count && LoadLittleEndian(bytes.data() + 16, 4) == Magic;
+        }
+
+        static std::vector<SequenceEntry> LoadEntries(std::istream &stream, const uint64_t indexOffset, const uint64_t count)
+        {
+            std::vector<SequenceEntry> entries(count);
+            std::array<uint8_t, SequenceEntry::Size> bytes;
+            stream.clear();
+            stream.seekg(static_cast<std::streamoff>(indexOffset));
+            for (auto &entry : entries)
+            {
+                if (!stream.read(reinterpret_cast<char *>(bytes.data()), SequenceEntry::Size))
+                {
+                    throw std::runtime_error("qoi15: truncated sequence index");
+                }
+                entry.Load(bytes.data());
+                if (entry.offset < HeaderSize || entry.offset + entry.size > indexOffset || (entry.temporal && &entry == &entries[0]))
+                {
+                    throw std::runtime_error("qoi15: inconsistent sequence index");
+                }
+            }
+            return entries;
+        }
+
+        //reads the index from the footer at the end, a sequence that is still being written or was never closed
+        //is walked frame by frame instead, its frames behind the last index have no timestamp or flags
+        static Index LoadIndex(std::istream &stream)
+        {
+            std::array<uint8_t, FileHeader::Size> bytes;
+            stream.seekg(0, std::ios::end);
+            auto size = static_cast<uint64_t>(stream.tellg());
+            stream.seekg(0);
+            if (size < HeaderSize || !stream.read(reinterpret_cast<char *>(bytes.data()), HeaderSize))
+            {
+                throw std::runtime_error("qoi15: truncated sequence");
+            }
+            LoadHeader(bytes.data());
+
+            Index index;
+            if (size >= HeaderSize + FooterSize)
+            {
+                stream.seekg(static_cast<std::streamoff>(size - FooterSize));
+                stream.read(reinterpret_cast<char *>(bytes.data()), FooterSize);
+                auto indexOffset = LoadLittleEndian(bytes.data() + 0, 8);
+                auto count = LoadLittleEndian(bytes.data() + 8, 8);
+                if (stream && LoadLittleEndian(bytes.data() + 16, 4) == Magic && indexOffset >= HeaderSize && indexOffset < size &&
+                    count <= (size - indexOffset) / SequenceEntry::Size && indexOffset + count * SequenceEntry::Size + FooterSize == size)
+                {
+                    index.entries = LoadEntries(stream, indexOffset, count);
+                    index.end = size;
+                    index.closed = true;
+                    return index;
+                }
+            }
+
+            //every complete frame counts, an earlier index replaces the frames in front of it to restore their timestamps
+            for (auto offset = static_cast<uint64_t>(HeaderSize);;)
+            {
+                if (HasIndex(stream, offset, index.entries.size(), size))
+                {
+                    index.entries = LoadEntries(stream, offset, index.entries.size());
+                    offset += index.entries.size() * SequenceEntry::Size + FooterSize;
+                    index.end = offset;
+                    continue;
+                }
 
-                uint8_t first, second, third;
-                chunker_.Get(value, first, second, third);
-                leftovers.emplace_back(first);
-                leftovers.emplace_back(second);
-                leftovers.emplace_back(third);
+                FileHeader header;
+                stream.clear();
+                stream.seekg(static_cast<std::streamoff>(offset));
+                if (offset + FileHeader::Size > size || !stream.read(reinterpret_cast<char *>(bytes.data()), FileHeader::Size))
+                {
+                    break;
+                }
+                try
+                {
+                    header.Load(bytes.data());
+                }
+                catch (const std::runtime_error &)
+                {
+                    break;
+                }
+                SequenceEntry entry;
+                entry.offset = offset;
+                entry.size = FrameSize(header);
+                entry.temporal = header.IsTemporal();
+                if (entry.size > size - offset || (entry.temporal && index.entries.empty()))
+                {
+                    break;
+                }
+                index.entries.push_back(entry);
+                offset += entry.size;
+                index.end = offset;
             }
+            stream.clear();
+            return index;
+        }
+    };
+
+    //records frames into one file, reopening an existing sequence appends to it, also one that was never closed
+    class SequenceWriter
+    {
+        std::fstream stream_;
+        FileWriter writer_;
+        std::vector<SequenceEntry> index_;
+        uint64_t end_;
+        bool dirty_;
+
+        //last frame, the reference of the next temporal frame
+        int keyInterval_;
+        int sinceKey_;
+        std::vector<uint16_t> reference_;
+        uint32_t referenceWidth_;
+        uint32_t referenceHeight_;
+        int referenceShift_;
 
-            if (runLengthValues.size() > 0)
+    public:
+        //keyInterval > 1 predicts frames from the frame before them and stores a key frame every keyInterval frames
+        explicit SequenceWriter(const std::string &path, const bool checksum = true, const bool append = true, const int keyInterval = 1)
+            : writer_(stream_, checksum), end_(SequenceLayout::HeaderSize), dirty_(true),
+              keyInterval_(keyInterval), sinceKey_(0), referenceWidth_(0), referenceHeight_(0), referenceShift_(0)
+        {
+            if (append)
+            {
+                stream_.open(path, std::ios::in | std::ios::out | std::ios::binary);
+            }
+            if (stream_.is_open())
+            {
+                //new frames go behind the old index, which stays valid for readers until Flush() writes the next one
+                auto index = SequenceLayout::LoadIndex(stream_);
+                index_ = std::move(index.entries);
+                end_ = index.end;
+                dirty_ = !index.closed;
+                if (!index.closed)
+                {
+                    //whatever a crash left behind the last complete frame
+                    stream_.close();
+                    std::filesystem::resize_file(path, end_);
+                    stream_.open(path, std::ios::in | std::ios::out | std::ios::binary);
+                }
+                stream_.clear();
+                stream_.seekp(static_cast<std::streamoff>(end_));
+            }
+            else
             {
-                auto length = runLength_.Set(runLengthValues);
-                runLengthValues.clear();
-                for (auto i = 0; i < length; ++i)
+                stream_.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+                if (!stream_.is_open())
                 {
-                    repository_.Set(bitShifter_.Set(previous));
+                    throw std::runtime_error("qoi15: cannot create " + path);
                 }
+                std::array<uint8_t, SequenceLayout::HeaderSize> header;
+                SequenceLayout::StoreHeader(header.data());
+                stream_.write(reinterpret_cast<const char *>(header.data()), header.size());
             }
         }
 
-        std::tuple<std::vector<uint16_t>::const_iterator, int> Get()
+        SequenceWriter(const SequenceWriter &) = delete;
+
+        ~SequenceWriter()
         {
-            return {repository_.GetIterator(), repository_.GetSize()};
+            try
+            {
+                Flush();
+            }
+            catch (...)
+            {
+            }
+        }
+
+        //returns the frame number
+        size_t Append(const uint16_t *pixels, const uint32_t width, const uint32_t height, const int internalShift = 1,
+                      const uint64_t timestamp = 0, const uint32_t flags = 0)
+        {
+            stream_.seekp(static_cast<std::streamoff>(end_));
+            SequenceEntry entry;
+            entry.offset = end_;
+
+            //a frame that does not match the reference, e.g. the first one after reopening, is a key frame
+            auto size = static_cast<size_t>(width) * height;
+            entry.temporal = keyInterval_ > 1 && sinceKey_ % keyInterval_ != 0 && width == referenceWidth_ &&
+                             height == referenceHeight_ && internalShift == referenceShift_;
+            if (entry.temporal)
+            {
+                entry.size = writer_.Write(pixels, width, height, internalShift, reference_.data());
+                sinceKey_++;
+            }
+            else
+            {
+                entry.size = writer_.Write(pixels, width, height, internalShift);
+                sinceKey_ = 1;
+            }
+            if (keyInterval_ > 1)
+            {
+                reference_.assign(pixels, pixels + size);
+                referenceWidth_ = width;
+                referenceHeight_ = height;
+                referenceShift_ = internalShift;
+            }
+            entry.timestamp = timestamp;
+            entry.flags = flags;
+            index_.push_back(entry);
+            end_ += entry.size;
+            dirty_ = true;
+            return index_.size() - 1;
+        }
+
+        size_t GetFrameCount() const
+        {
+            return index_.size();
+        }
+
+        //writes the index behind the frames, readers opened afterwards see every appended frame,
+        //each call leaves the whole index in the file, so flush after batches of frames rather than after each one
+        void Flush()
+        {
+            if (!dirty_)
+            {
+                return;
+            }
+            std::array<uint8_t, SequenceEntry::Size> bytes;
+            stream_.seekp(static_cast<std::streamoff>(end_));
+            for (auto &entry : index_)
+            {
+                entry.Store(bytes.data());
+                stream_.write(reinterpret_cast<const char *>(bytes.data()), SequenceEntry::Size);
+            }
+            SequenceLayout::StoreFooter(bytes.data(), end_, index_.size());
+            stream_.write(reinterpret_cast<const char *>(bytes.data()), SequenceLayout::FooterSize);
+            stream_.flush();
+            if (!stream_)
+            {
+                throw std::runtime_error("qoi15: failed to write the sequence index");
+            }
+            //the next frames follow this index, which becomes a dead copy once a later one is written
+            end_ += index_.size() * SequenceEntry::Size + SequenceLayout::FooterSize;
+            dirty_ = false;
+        }
+    };
+
+    //random access to the frames of a sequence, ReadFrame() may be called from several threads
+    class SequenceReader
+    {
+        std::string path_;
+        std::vector<SequenceEntry> index_;
+
+        //every call gets its own stream, so that readers never share a file position
+        std::ifstream OpenFrame(const size_t frame) const
+        {
+            if (frame >= index_.size())
+            {
+                throw std::out_of_range("qoi15: frame number is beyond the sequence");
+            }
+            std::ifstream stream(path_, std::ios::binary);
+            stream.seekg(static_cast<std::streamoff>(index_[frame].offset));
+            return stream;
+        }
+
+    public:
+        explicit SequenceReader(const std::string &path)
+            : path_(path)
+        {
+            std::ifstream stream(path_, std::ios::binary);
+            if (!stream.is_open())
+            {
+                throw std::runtime_error("qoi15: cannot open " + path);
+            }
+            index_ = SequenceLayout::LoadIndex(stream).entries;
+        }
+
+        size_t GetFrameCount() const
+        {
+            return index_.size();
+        }
+
+        const SequenceEntry &GetEntry(const size_t frame) const
+        {
+            return index_.at(frame);
+        }
+
+        FileHeader GetFrameHeader(const size_t frame) const
+        {
+            auto stream = OpenFrame(frame);
+            return FileReader(stream).GetHeader();
+        }
+
+        //returns the number of pixels written into out, a temporal frame decodes every frame back to its key frame
+        size_t ReadFrame(const size_t frame, uint16_t *out, const size_t outCapacity) const
+        {
+            auto key = frame;
+            while (GetEntry(key).temporal)
+            {
+                key--;
+            }
+
+            std::vector<uint16_t> reference;
+            std::vector<uint16_t> current;
+            for (auto i = key; i < frame; ++i)
+            {
+                auto stream = OpenFrame(i);
+                FileReader reader(stream);
+                current.resize(reader.GetHeader().pixels);
+                reader.Read(current.data(), current.size(), reference.data());
+                reference.swap(current);
+            }
+            auto stream = OpenFrame(frame);
+            return FileReader(stream).Read(out, outCapacity, reference.data());
+        }
+
+        std::vector<uint16_t> ReadFrame(const size_t frame) const
+        {
+            std::vector<uint16_t> pixels(GetFrameHeader(frame).pixels);
+            ReadFrame(frame, pixels.data(), pixels.size());
+            return pixels;
+        }
+    };
+
+#ifdef QOI15_MMAP
+    //whole file mapping, read only or created at a fixed size for writing
+    class MappedFile
+    {
+        int fd_;
+        uint8_t *data_;
+        size_t size_;
+
+        void Map(const int protection)
+        {
+            if (size_ == 0)
+            {
+                return;
+            }
+            auto data = mmap(nullptr, size_, protection, MAP_SHARED, fd_, 0);
+            if (data == MAP_FAILED)
+            {
+                auto error = errno;
+                close(fd_);
+                throw std::system_error(error, std::generic_category(), "qoi15: mmap");
+            }
+            data_ = static_cast<uint8_t *>(data);
+        }
+
+    public:
+        explicit MappedFile(const std::string &path)
+            : fd_(open(path.c_str(), O_RDONLY)), data_(nullptr), size_(0)
+        {
+            if (fd_ < 0)
+            {
+                throw std::system_error(errno, std::generic_category(), "qoi15: open " + path);
+            }
+            struct stat status;
+            if (fstat(fd_, &status) != 0)
+            {
+                auto error = errno;
+                close(fd_);
+                throw std::system_error(error, std::generic_category(), "qoi15: fstat " + path);
+            }
+            size_ = static_cast<size_t>(status.st_size);
+            Map(PROT_READ);
+        }
+
+        //creates or truncates path to size bytes
+        MappedFile(const std::string &path, const size_t size)
+            : fd_(open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644)), data_(nullptr), size_(size)
+        {
+            if (fd_ < 0)
+            {
+                throw std::system_error(errno, std::generic_category(), "qoi15: open " + path);
+            }
+            if (ftruncate(fd_, static_cast<off_t>(size_)) != 0)
+            {
+                auto error = errno;
+                close(fd_);
+                throw std::system_error(error, std::generic_category(), "qoi15: ftruncate " + path);
+            }
+            Map(PROT_READ | PROT_WRITE);
+        }
+
+        MappedFile(const MappedFile &) = delete;
+
+        ~MappedFile()
+        {
+            if (data_ != nullptr)
+            {
+                munmap(data_, size_);
+            }
+            close(fd_);
+        }
+
+        uint8_t *GetData()
+        {
+            return data_;
+        }
+
+        size_t GetSize() const
+        {
+            return size_;
+        }
+
+        //the kernel may read ahead aggressively and drop pages behind
+        void AdviseSequential()
+        {
+            if (data_ != nullptr)
+            {
+                madvise(data_, size_, MADV_SEQUENTIAL);
+            }
+        }
+
+        //unmaps and cuts the file to its final size
+        void Truncate(const size_t size)
+        {
+            if (data_ != nullptr)
+            {
+                munmap(data_, size_);
+                data_ = nullptr;
+            }
+            size_ = size;
+            if (ftruncate(fd_, static_cast<off_t>(size_)) != 0)
+            {
+                throw std::system_error(errno, std::generic_category(), "qoi15: ftruncate");
+            }
+        }
+    };
+
+    //same file format as FileWriter, encoded straight into a mapping of the worst-case size
+    class MappedFileWriter
+    {
+        bool checksum_;
+        int indexRows_;
+        std::vector<RestartPoint> points_;
+
+    public:
+        explicit MappedFileWriter(const bool checksum = true, const int indexRows = 0)
+            : checksum_(checksum), indexRows_(indexRows)
+        {
+        }
+
+        //returns the file size in bytes, an invalid frame throws before path is opened
+        size_t Write(const std::string &path, const uint16_t *pixels, const uint32_t width, const uint32_t height, const int internalShift = 1)
+        {
+            if (internalShift < LosslessShift || internalShift > MaxShift || (internalShift == LosslessShift && indexRows_ > 0))
+            {
+                throw std::invalid_argument("qoi15: unsupported shift");
+            }
+
+            FileHeader header;
+            header.shift = static_cast<uint8_t>(internalShift);
+            header.flags = (checksum_ ? FileHeader::ChecksumFlag : 0) | (indexRows_ > 0 ? FileHeader::IndexFlag : 0);
+            header.width = width;
+            header.height = height;
+            header.indexRows = indexRows_ > 0 ? static_cast<uint32_t>(indexRows_) : 0;
+            header.pixels = static_cast<uint64_t>(width) * height;
+            if (MaxEncodedSize(static_cast<size_t>(header.pixels), internalShift) > FileHeader::MaxCount)
+            {
+                throw std::invalid_argument("qoi15: image too large");
+            }
+
+            auto indexSize = header.GetIndexSize();
+            auto capacity = MaxEncodedSize(header.pixels, internalShift);
+            MappedFile file(path, FileHeader::Size + capacity * 2 + indexSize * FileIndexEntry::Size);
+            auto payload = file.GetData() + FileHeader::Size;
+
+            if (internalShift == LosslessShift)
+            {
+                header.words = EncodeInto<LosslessShift>(pixels, static_cast<size_t>(header.pixels), reinterpret_cast<uint16_t *>(payload), capacity);
+            }
+            else
+            {
+                DispatchShift(internalShift, [&](auto shift)
+                              {
+                                  QOI15Encoder<decltype(shift)::value> encoder;
+                                  auto out = reinterpret_cast<uint16_t *>(payload);
+                                  if (header.HasIndex())
+                                  {
+                                      encoder.Encode(pixels, static_cast<int>(header.pixels), out, indexRows_ * static_cast<int>(width), points_);
+                                  }
+                                  else
+                                  {
+                                      encoder.Encode(pixels, static_cast<int>(header.pixels), out);
+                                  }
+                                  header.words = static_cast<uint64_t>(std::get<1>(encoder.Get()));
+                              });
+            }
+
+            auto payloadSize = static_cast<size_t>(header.words) * 2;
+            if (checksum_)
+            {
+                header.checksum = Crc32c(payload, payloadSize);
+            }
+            header.Store(file.GetData());
+            for (uint64_t i = 0; i < indexSize; ++i)
+            {
+                FileIndexEntry::Store(payload + payloadSize + i * FileIndexEntry::Size, points_[i]);
+            }
+
+            auto size = FileHeader::Size + payloadSize + static_cast<size_t>(indexSize) * FileIndexEntry::Size;
+            file.Truncate(size);
+            return size;
+        }
+    };
+
+    //decodes from the mapping, the words are never copied
+    class MappedFileReader
+    {
+        MappedFile file_;
+        FileHeader header_;
+
+    public:
+        explicit MappedFileReader(const std::string &path)
+            : file_(path)
+        {
+            if (file_.GetSize() < static_cast<size_t>(FileHeader::Size))
+            {
+                throw std::runtime_error("qoi15: truncated file header");
+            }
+            header_.Load(file_.GetData());
+            if (file_.GetSize() < FileHeader::Size + header_.words * 2 + header_.GetIndexSize() * FileIndexEntry::Size)
+            {
+                throw std::runtime_error("qoi15: truncated file");
+            }
+            file_.AdviseSequential();
+        }
+
+        const FileHeader &GetHeader() const
+        {
+            return header_;
+        }
+
+        //the encoded words inside the mapping
+        const uint16_t *GetWords()
+        {
+            return reinterpret_cast<const uint16_t *>(file_.GetData() + FileHeader::Size);
+        }
+
+        //returns the number of pixels written into out, temporal frames need the reference they were written with
+        size_t Read(uint16_t *out, const size_t outCapacity, const uint16_t *reference = nullptr)
+        {
+            if (outCapacity < header_.pixels)
+            {
+                throw std::length_error("qoi15: output capacity is smaller than the image");
+            }
+            if (header_.IsTemporal() && reference == nullptr)
+            {
+                throw std::invalid_argument("qoi15: temporal frame needs its reference frame");
+            }
+            if (header_.HasChecksum() && Crc32c(file_.GetData() + FileHeader::Size, static_cast<size_t>(header_.words) * 2) != header_.checksum)
+            {
+                throw std::runtime_error("qoi15: checksum mismatch");
+            }
+
+            auto written = DecodeFile(header_, GetWords(), out);
+            if (written != header_.pixels)
+            {
+                throw std::runtime_error("qoi15: stream ends before the image");
+            }
+            header_.Reconstruct(out, header_.height, reference);
+            return written;
         }
     };
+#endif
 }
@@ -0,0 +1,407 @@
+// MIT License
+
+// Copyright (c) 2022 Naoki Ikeda
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+//seeded 16bit mono test frames that look like sensor data, for benchmarks and tests without image files
+namespace qoi15
+{
+    enum class SyntheticKind
+    {
+        //smooth scene with photon shot noise, read noise and column offsets
+        Sensor,
+        //dark sky with point sources, some of them saturated
+        StarField,
+        //planes and boxes in millimetres, 0 where the depth is invalid
+        Depth,
+        //smooth temperature field in centikelvin with warm spots
+        Thermal,
+        //tiled detector with per panel gain, gaps, dead columns and hot pixels
+        MaskedPanel,
+    };
+
+    inline const char *GetSyntheticName(const SyntheticKind kind)
+    {
+        switch (kind)
+        {
+        case SyntheticKind::Sensor:
+            return "sensor";
+        case SyntheticKind::StarField:
+            return "starfield";
+        case SyntheticKind::Depth:
+            return "depth";
+        case SyntheticKind::Thermal:
+            return "thermal";
+        case SyntheticKind::MaskedPanel:
+            return "panel";
+        }
+        return "";
+    }
+
+    inline const std::vector<SyntheticKind> &GetSyntheticKinds()
+    {
+        static const std::vector<SyntheticKind> kinds{SyntheticKind::Sensor, SyntheticKind::StarField, SyntheticKind::Depth,
+                                                      SyntheticKind::Thermal, SyntheticKind::MaskedPanel};
+        return kinds;
+    }
+
+    //every pixel only depends on the seed and its position, so rows can be made in any order or in parallel,
+    //the arithmetic is integer fixed point, so a seed gives the same frame with every compiler and platform
+    class SyntheticImage
+    {
+        //fixed point 1.0, values carry 16 fractional bits
+        static constexpr int64_t One = 1 << 16;
+
+        struct Star
+        {
+            int x;
+            int y;
+            int64_t amplitude;
+        };
+
+        struct Box
+        {
+            int x0;
+            int y0;
+            int x1;
+            int y1;
+            int64_t depth;
+        };
+
+        struct Spot
+        {
+            int64_t x;
+            int64_t y;
+            int64_t amplitude;
+        };
+
+        static constexpr int StarRadius = 6;
+        static constexpr int PanelSize = 512;
+        static constexpr int PanelGap = 8;
+
+        SyntheticKind kind_;
+        int width_;
+        int height_;
+        uint64_t seed_;
+        //the stars sorted by row
+        std::vector<Star> stars_;
+        std::vector<Box> boxes_;
+        std::vector<Spot> spots_;
+
+        //splitmix64 finalizer
+        static uint64_t Mix(uint64_t value)
+        {
+            value += 0x9E3779B97F4A7C15ull;
+            value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+            value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+            return value ^ (value >> 31);
+        }
+
+        uint64_t Hash(const uint64_t stream, const int x, const int y) const
+        {
+            return Mix(seed_ ^ Mix(stream ^ (static_cast<uint64_t>(static_cast<uint32_t>(y)) << 32 | static_cast<uint32_t>(x))));
+        }
+
+        //product of two fixed point values, rounded towards 0
+        static int64_t Mul(const int64_t a, const int64_t b)
+        {
+            return a * b / One;
+        }
+
+        //square root of a fixed point value, 0 for negative ones
+        static int64_t Sqrt(const int64_t value)
+        {
+            auto rest = static_cast<uint64_t>(std::max<int64_t>(value, 0)) << 16;
+            uint64_t root = 0;
+            uint64_t bit = 1ull << 62;
+            while (bit > rest)
+            {
+                bit >>= 2;
+            }
+            for (; bit != 0; bit >>= 2)
+            {
+                if (rest >= root + bit)
+                {
+                    rest -= root + bit;
+                    root = (root >> 1) + bit;
+                }
+                else
+                {
+                    root >>= 1;
+                }
+            }
+            return static_cast<int64_t>(root);
+        }
+
+        //[0, One)
+        int64_t Uniform(const uint64_t stream, const int x, const int y) const
+        {
+            return static_cast<int64_t>(Hash(stream, x, y) >> 48);
+        }
+
+        //true with a probability of perMillion / 1000000
+        bool Chance(const uint64_t stream, const int x, const int y, const uint64_t perMillion) const
+        {
+            return (Hash(stream, x, y) >> 32) * 1000000 < perMillion << 32;
+        }
+
+        //sum of 4 uniforms, close enough to a unit normal for noise and cheap
+        int64_t Normal(const uint64_t stream, const int x, const int y) const
+        {
+            auto bits = Hash(stream, x, y);
+            auto sum = static_cast<int64_t>((bits & 0xFFFF) + ((bits >> 16) & 0xFFFF) + ((bits >> 32) & 0xFFFF) + (bits >> 48));
+            //the sum has a mean of 2 * 65535 and a deviation of One / sqrt(3)
+            return (sum - 2 * 65535) * 113512 / One;
+        }
+
+        //bilinear interpolation of uniform values on a grid of cell pixels, in [0, One)
+        int64_t Smooth(const uint64_t stream, const int x, const int y, const int cell) const
+        {
+            auto gx = x / cell;
+            auto gy = y / cell;
+            auto fx = static_cast<int64_t>(x % cell) * One / cell;
+            auto fy = static_cast<int64_t>(y % cell) * One / cell;
+            //smoothstep hides the grid
+            fx = Mul(Mul(fx, fx), 3 * One - 2 * fx);
+            fy = Mul(Mul(fy, fy), 3 * One - 2 * fy);
+            auto top = Mul(Uniform(stream, gx, gy), One - fx) + Mul(Uniform(stream, gx + 1, gy), fx);
+            auto bottom = Mul(Uniform(stream, gx, gy + 1), One - fx) + Mul(Uniform(stream, gx + 1, gy + 1), fx);
+            return Mul(top, One - fy) + Mul(bottom, fy);
+        }
+
+        static uint16_t Clamp(const int64_t value)
+        {
+            return static_cast<uint16_t>(std::min<int64_t>(65535, std::max<int64_t>(0, value + One / 2) / One));
+        }
+
+        uint16_t Sensor(const int x, const int y) const
+        {
+            //electrons of a smooth scene, gain 0.5 DN per electron, bias 100 DN
+            auto electrons = 2000 * One + 60000 * Smooth(1, x, y, std::max(16, width_ / 8)) + 8000 * Smooth(2, x, y, 16);
+            auto shot = Mul(Sqrt(electrons), Normal(3, x, y));
+            auto column = 4 * Normal(4, x, 0);
+            auto read = 3 * Normal(5, x, y);
+            return Clamp(100 * One + (electrons + shot) / 2 + column + read);
+        }
+
+        //adds the stars near row y to light, a Moffat profile with beta 2 needs no transcendental functions
+        void StarLight(const int y, int64_t *light) const
+        {
+            auto first = std::lower_bound(stars_.begin(), stars_.end(), y - StarRadius, [](const Star &star, const int row)
+                                          { return star.y < row; });
+            for (auto star = first; star != stars_.end() && star->y <= y + StarRadius; ++star)
+            {
+                auto dy = y - star->y;
+                for (auto x = std::max(0, star->x - StarRadius); x <= std::min(width_ - 1, star->x + StarRadius); x++)
+                {
+                    //1 + r * r / 2.25 is (9 + 4 * r * r) / 9
+                    auto dx = x - star->x;
+                    auto falloff = static_cast<int64_t>(9 + 4 * (dx * dx + dy * dy));
+                    light[x] += star->amplitude * 81 / (falloff * falloff);
+                }
+            }
+        }
+
+        uint16_t StarField(const int x, const int y, const int64_t light) const
+        {
+            auto sky = 400 * One + 150 * Smooth(1, x, y, std::max(16, width_ / 4));
+            auto signal = sky + light;
+            return Clamp(signal + Mul(Sqrt(signal), Normal(2, x, y)) + 5 * Normal(3, x, y) / 2);
+        }
+
+        uint16_t Depth(const int x, const int y) const
+        {
+            //a floor that recedes towards the top, boxes in front of it
+            auto depth = 12000 * One - 10000 * One * y / height_;
+            auto edge = false;
+            for (const auto &box : boxes_)
+            {
+                if (x >= box.x0 && x < box.x1 && y >= box.y0 && y < box.y1)
+                {
+                    depth = box.depth;
+                    edge = x - box.x0 < 3 || box.x1 - x <= 3;
+                }
+            }
+            //no return at edges, on dropout blobs and beyond the range
+            if (edge || Smooth(1, x, y, 24) * 100 > 88 * One || depth > 10000 * One)
+            {
+                return 0;
+            }
+            //quantization and noise grow with the square of the distance, 1 + 2e-7 * depth * depth
+            auto sigma = One + depth * depth / (5000000 * One);
+            return Clamp(depth + Mul(sigma, Normal(2, x, y)));
+        }
+
+        uint16_t Thermal(const int x, const int y) const
+        {
+            auto u = static_cast<int64_t>(x) * One / width_;
+            auto v = static_cast<int64_t>(y) * One / height_;
+            //29315 is 20 degrees Celsius
+            auto temperature = 29315 * One + 400 * v + 300 * Smooth(1, x, y, std::max(16, width_ / 6));
+            for (const auto &spot : spots_)
+            {
+                auto r2 = 100 * (Mul(u - spot.x, u - spot.x) + Mul(v - spot.y, v - spot.y));
+                temperature += spot.amplitude * One / (One + r2);
+            }
+            return Clamp(temperature + 2 * Normal(2, x, y));
+        }
+
+        uint16_t MaskedPanel(const int x, const int y) const
+        {
+            auto px = x % PanelSize;
+            auto py = y % PanelSize;
+            if (px >= PanelSize - PanelGap || py >= PanelSize - PanelGap)
+            {
+                return 0;
+            }
+            auto panelX = x / PanelSize;
+            auto panelY = y / PanelSize;
+            //dead columns and hot pixels
+            if (Chance(1, x, 0, 2000))
+            {
+                return 0;
+            }
+            if (Chance(2, x, y, 200))
+            {
+                return 65535;
+            }
+            auto gain = (9 * One + 2 * Uniform(3, panelX, panelY)) / 10;
+            auto offset = 200 * One + 100 * Uniform(4, panelX, panelY);
+            auto illumination = 3000 * One + 20000 * Smooth(5, x, y, std::max(16, width_ / 3));
+            return Clamp(offset + Mul(gain, illumination + Mul(Sqrt(illumination), Normal(6, x, y))));
+        }
+
+        uint16_t Pixel(const int x, const int y, const int64_t *light) const
+        {
+            switch (kind_)
+            {
+            case SyntheticKind::Sensor:
+                return Sensor(x, y);
+            case SyntheticKind::StarField:
+                return StarField(x, y, light[x]);
+            case SyntheticKind::Depth:
+                return Depth(x, y);
+            case SyntheticKind::Thermal:
+                return Thermal(x, y);
+            case SyntheticKind::MaskedPanel:
+                return MaskedPanel(x, y);
+            }
+            return 0;
+        }
+
+    public:
+        //any size from a few pixels up, e.g. 256x256 to 16384x16384
+        SyntheticImage(const SyntheticKind kind, const int width, const int height, const uint64_t seed = 1)
+            : kind_(kind), width_(width), height_(height), seed_(Mix(seed))
+        {
+            if (width <= 0 || height <= 0)
+            {
+                throw std::invalid_argument("qoi15: synthetic image must not be empty");
+            }
+
+            if (kind_ == SyntheticKind::StarField)
+            {
+                //one star per 1500 pixels, brightness falls off with a power law, 50 / (0.001 + u * u)
+                auto count = static_cast<int64_t>(width) * height / 1500;
+                stars_.reserve(static_cast<size_t>(count));
+                for (int64_t i = 0; i < count; i++)
+                {
+                    auto index = static_cast<int>(i);
+                    auto u = Uniform(1, index, 3);
+                    Star star;
+                    star.x = static_cast<int>(Uniform(1, index, 1) * width / One);
+                    star.y = static_cast<int>(Uniform(1, index, 2) * height / One);
+                    star.amplitude = 50 * One * One * One / (One * One / 1000 + u * u);
+                    stars_.push_back(star);
+                }
+                std::sort(stars_.begin(), stars_.end(), [](const Star &a, const Star &b)
+                          { return a.y < b.y || (a.y == b.y && a.x < b.x); });
+            }
+            if (kind_ == SyntheticKind::Depth)
+            {
+                //corners at 0.8 * u of the width and (0.3 + 0.5 * u) of the height, sides of 0.05 + 0.2 * u
+                for (auto i = 0; i < 6; i++)
+                {
+                    Box box;
+                    box.x0 = static_cast<int>(4 * Uniform(2, i, 1) * width / (5 * One));
+                    box.y0 = static_cast<int>((3 * One + 5 * Uniform(2, i, 2)) * height / (10 * One));
+                    box.x1 = box.x0 + static_cast<int>((One + 4 * Uniform(2, i, 3)) * width / (20 * One)) + 4;
+                    box.y1 = box.y0 + static_cast<int>((One + 4 * Uniform(2, i, 4)) * height / (20 * One)) + 1;
+                    box.depth = 800 * One + 4000 * Uniform(2, i, 5);
+                    boxes_.push_back(box);
+                }
+            }
+            if (kind_ == SyntheticKind::Thermal)
+            {
+                for (auto i = 0; i < 4; i++)
+                {
+                    spots_.push_back({Uniform(3, i, 1), Uniform(3, i, 2), 500 * One + 1500 * Uniform(3, i, 3)});
+                }
+            }
+        }
+
+        int GetWidth() const
+        {
+            return width_;
+        }
+
+        int GetHeight() const
+        {
+            return height_;
+        }
+
+        //writes rows [y0, y1), out holds (y1 - y0) * width pixels
+        void GenerateRows(const int y0, const int y1, uint16_t *out) const
+        {
+            if (y0 < 0 || y0 > y1 || y1 > height_)
+            {
+                throw std::invalid_argument("qoi15: rows are outside the image");
+            }
+            std::vector<int64_t> light(kind_ == SyntheticKind::StarField ? width_ : 0);
+            for (auto y = y0; y < y1; y++)
+            {
+                if (!light.empty())
+                {
+                    std::fill(light.begin(), light.end(), 0);
+                    StarLight(y, light.data());
+                }
+                for (auto x = 0; x < width_; x++)
+                {
+                    *out++ = Pixel(x, y, light.data());
+                }
+            }
+        }
+
+        std::vector<uint16_t> Generate() const
+        {
+            std::vector<uint16_t> pixels(static_cast<size_t>(width_) * height_);
+            GenerateRows(0, height_, pixels.data());
+            return pixels;
+        }
+    };
+}
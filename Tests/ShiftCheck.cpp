@@ -0,0 +1,9 @@
+//built by ctest from Tests/CMakeLists.txt, completing CODEC<SHIFT> instantiates its shift checks
+#include <qoi15.hpp>
+
+static_assert(sizeof(qoi15::CODEC<SHIFT>) > 0, "complete type");
+
+int main()
+{
+    return 0;
+}
@@ -1,11 +1,103 @@
 #include <gtest/gtest.h>
 #include <iostream>
 #include <filesystem>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <sstream>
+#include <fstream>
 
-#define ENABLE_STATICS
 #include <qoi15.hpp>
+#include <qoi15synthetic.hpp>
 #include <opencv2/opencv.hpp>
 
+//counts every heap allocation made by the test process, the replacements below only forward to these two,
+//which are kept out of line so that GCC does not pair the inlined free() with the new expression
+#ifdef _MSC_VER
+#define TEST_NOINLINE __declspec(noinline)
+#else
+#define TEST_NOINLINE __attribute__((noinline))
+#endif
+
+static std::atomic<int> allocationCount(0);
+
+TEST_NOINLINE static void *countedAllocate(const std::size_t size, const std::size_t alignment)
+{
+    allocationCount++;
+    //aligned_alloc needs a size that is a multiple of the alignment
+    auto p = alignment <= alignof(std::max_align_t) ? std::malloc(size) : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    if (p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+TEST_NOINLINE static void countedRelease(void *p)
+{
+    std::free(p);
+}
+
+void *operator new(std::size_t size)
+{
+    return countedAllocate(size, 0);
+}
+
+void *operator new[](std::size_t size)
+{
+    return countedAllocate(size, 0);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+    return countedAllocate(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return countedAllocate(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void *p) noexcept
+{
+    countedRelease(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    countedRelease(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    countedRelease(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+    countedRelease(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+    countedRelease(p);
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept
+{
+    countedRelease(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept
+{
+    countedRelease(p);
+}
+
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept
+{
+    countedRelease(p);
+}
+
 TEST(helloworld, simple)
 {
     std::cout << "hello world!" << std::endl;
@@ -16,16 +108,20 @@ class PNG16
     std::string resolvePath(const std::string &relPath)
     {
         auto baseDir = std::filesystem::current_path();
-        while (baseDir.has_parent_path())
+        while (true)
         {
             auto combinePath = baseDir / relPath;
             if (std::filesystem::exists(combinePath))
             {
                 return combinePath.string();
             }
+            //the root is its own parent
+            if (baseDir == baseDir.parent_path())
+            {
+                throw std::runtime_error("File not found!");
+            }
             baseDir = baseDir.parent_path();
         }
-        throw std::runtime_error("File not found!");
     }
 
     cv::Mat mono_;
@@ -83,16 +179,13 @@ TEST(RunLength, simple)
     EXPECT_EQ(false, runLength.CheckHeader(0x10));
     EXPECT_EQ(false, runLength.CheckHeader(0x08));
 
-    auto runValues = runLength.Get(10);
-    auto ite = runValues.begin();
+    uint8_t runValues[runLength.MaxCount];
+    auto count = runLength.Get(10, runValues);
+    EXPECT_EQ(2, count);
+    EXPECT_EQ(0b010, runValues[0]);
+    EXPECT_EQ(0b001, runValues[1]);
 
-    auto value1 = *ite;
-    ite++;
-    auto value2 = *ite;
-    EXPECT_EQ(0b010, value1);
-    EXPECT_EQ(0b001, value2);
-
-    auto run = runLength.Set(runValues);
+    auto run = runLength.Set(runValues, count);
     EXPECT_EQ(10, run);
 }
 
@@ -162,6 +255,36 @@ TEST(Chunker, simple)
     EXPECT_EQ(0x15, third);
 }
 
+TEST(CountingRepository, simple)
+{
+    std::vector<uint16_t> values(1000);
+    for (auto i = 0; i < 1000; i++)
+    {
+        values[i] = static_cast<uint16_t>((i / 3) * 10);
+    }
+
+    qoi15::QOI15Encoder<1> encoder1(&values[0], values.size());
+    auto [_, size1] = encoder1.Get();
+
+    qoi15::QOI15Encoder<1, qoi15::CountingRepository> encoder2;
+    encoder2.Encode(&values[0], values.size());
+    EXPECT_EQ(size1, encoder2.GetRepository().GetSize());
+}
+
+TEST(WordTable, simple)
+{
+    using WordTable = qoi15::WordTable<qoi15::RunLength<2, 3, 0x00, 0x07>,
+                                       qoi15::Differential<1, 4, 0x10, 0x0F>,
+                                       qoi15::Table<2, 3, 0x08, 0x07>>;
+    const auto &table = WordTable::Instance();
+
+    //run 0b010, diff -3 and table 0x05
+    auto actions = table.Get(0x02 | (0x15 << 5) | (0x0D << 10));
+    EXPECT_EQ(WordTable::RunAction | 0x02, actions & 0xFF);
+    EXPECT_EQ(WordTable::DiffAction | (WordTable::DiffBias - 3), (actions >> 8) & 0xFF);
+    EXPECT_EQ(WordTable::TableAction | 0x05, (actions >> 16) & 0xFF);
+}
+
 TEST(SpeedFirstRepository, simple)
 {
     qoi15::SpeedFirstRepository repository(100);
@@ -178,6 +301,193 @@ TEST(SpeedFirstRepository, simple)
     EXPECT_EQ(0x7FFF, *ite);
 }
 
+TEST(QOI15Encoder, allocation)
+{
+    std::vector<uint16_t> flat(100000, 0x1234);
+    std::vector<uint16_t> noisy(100000);
+    uint32_t seed = 1;
+    for (auto &value : noisy)
+    {
+        seed = seed * 1664525 + 1013904223;
+        value = static_cast<uint16_t>(seed >> 16);
+    }
+
+    //only the output buffer may be allocated, whatever the tokens are
+    auto before = allocationCount.load();
+    qoi15::QOI15Encoder encoder1(&flat[0], flat.size());
+    EXPECT_EQ(1, allocationCount.load() - before);
+
+    before = allocationCount.load();
+    qoi15::QOI15Encoder encoder2(&noisy[0], noisy.size());
+    EXPECT_EQ(1, allocationCount.load() - before);
+}
+
+TEST(QOI15Encoder, reuse)
+{
+    std::vector<uint16_t> frame1(5000), frame2(5000);
+    for (auto i = 0; i < 5000; i++)
+    {
+        frame1[i] = static_cast<uint16_t>(i * 3) & 0xFFFE;
+        frame2[i] = static_cast<uint16_t>((i / 7) * 40) & 0xFFFE;
+    }
+
+    qoi15::QOI15Encoder encoder;
+    qoi15::QOI15Decoder decoder;
+    encoder.Encode(&frame1[0], frame1.size());
+    auto [ite0, size0] = encoder.Get();
+    decoder.Decode(ite0, size0, frame1.size());
+
+    //the buffers of the first frame are reused
+    auto before = allocationCount.load();
+    encoder.Encode(&frame2[0], frame2.size());
+    auto [ite1, size1] = encoder.Get();
+    decoder.Decode(ite1, size1, frame2.size());
+    EXPECT_EQ(0, allocationCount.load() - before);
+
+    //nothing leaks from the previous frame
+    qoi15::QOI15Encoder fresh(&frame2[0], frame2.size());
+    auto [ite2, size2] = fresh.Get();
+    EXPECT_EQ(std::vector<uint16_t>(ite2, ite2 + size2), std::vector<uint16_t>(ite1, ite1 + size1));
+
+    auto [ite3, size3] = decoder.Get();
+    EXPECT_EQ(frame2, std::vector<uint16_t>(ite3, ite3 + size3));
+}
+
+TEST(QOI15Encoder, simd)
+{
+    //runs, small steps, repeated values and jumps mixed at random
+    std::vector<uint16_t> values(20000);
+    uint32_t seed = 7;
+    uint16_t current = 0x4000;
+    for (auto &value : values)
+    {
+        seed = seed * 1664525 + 1013904223;
+        auto kind = (seed >> 8) % 10;
+        if (kind < 4)
+        {
+            current += static_cast<int16_t>((seed >> 16) % 41) - 20;
+        }
+        else if (kind < 6)
+        {
+            current = static_cast<uint16_t>((seed >> 16) % 8) * 0x1000;
+        }
+        else if (kind < 7)
+        {
+            current = static_cast<uint16_t>(seed >> 12);
+        }
+        value = current;
+    }
+
+    for (auto level : {qoi15::SimdLevel::SSE41, qoi15::SimdLevel::AVX2})
+    {
+        qoi15::QOI15Encoder<1> scalar;
+        scalar.SetSimdLevel(qoi15::SimdLevel::Scalar);
+        qoi15::QOI15Encoder<1> simd;
+        simd.SetSimdLevel(level);
+
+        for (auto size : {0, 1, 2, 17, 33, 20000})
+        {
+            scalar.Encode(&values[0], size);
+            simd.Encode(&values[0], size);
+            auto [ite1, size1] = scalar.Get();
+            auto [ite2, size2] = simd.Get();
+            EXPECT_EQ(std::vector<uint16_t>(ite1, ite1 + size1), std::vector<uint16_t>(ite2, ite2 + size2));
+        }
+    }
+}
+
+TEST(QOI15Encoder, stats)
+{
+    //run of 8, diffs -3 and +1, a raw, a table hit
+    std::vector<uint16_t> values{0x0100, 0x0100, 0x0100, 0x0100, 0x0100, 0x0100, 0x0100, 0x0100, 0x0100,
+                                 0x00FA, 0x00FC, 0x3006, 0x0100};
+    qoi15::QOI15Encoder<1, qoi15::SpeedFirstRepository, qoi15::DefaultLayout, true> encoder(&values[0], values.size());
+    auto &stats = encoder.GetStats();
+    EXPECT_EQ(8, stats.runPixels);
+    EXPECT_EQ(1, stats.runHistogram[3]);
+    EXPECT_EQ(2, stats.GetCount(qoi15::TokenClass::Diff));
+    EXPECT_EQ(1, stats.diffHistogram[3]);
+    EXPECT_EQ(1, stats.diffHistogram[1]);
+    EXPECT_EQ(2, stats.GetCount(qoi15::TokenClass::Raw));
+    EXPECT_EQ(32, stats.GetBits(qoi15::TokenClass::Raw));
+    EXPECT_EQ(1, stats.GetCount(qoi15::TokenClass::Table));
+    EXPECT_DOUBLE_EQ(1.0 / 3, stats.GetTableHitRate());
+    EXPECT_EQ(0, stats.tableCollisions);
+
+    //every bit of the stream belongs to a class, or is the flag of a packed word
+    std::vector<uint16_t> noise(20000);
+    uint32_t seed = 9;
+    for (auto i = 0; i < static_cast<int>(noise.size()); i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        noise[i] = static_cast<uint16_t>((i / 50) * 40 + ((seed >> 28) == 0 ? (seed & 0x3FF) : i % 7));
+    }
+    std::vector<uint16_t> encoded(qoi15::MaxEncodedSize(noise.size()));
+    qoi15::EncoderStats total;
+    auto words = qoi15::EncodeInto(6, &noise[0], noise.size(), &encoded[0], encoded.size(), &total);
+    std::vector<uint16_t> plain(encoded.size());
+    EXPECT_EQ(words, qoi15::EncodeInto(6, &noise[0], noise.size(), &plain[0], plain.size()));
+    EXPECT_TRUE(std::equal(plain.begin(), plain.begin() + words, encoded.begin()));
+
+    uint64_t bits = 0;
+    uint64_t values5 = 0;
+    for (auto i = 0; i < qoi15::EncoderStats::ClassCount; i++)
+    {
+        bits += total.bits[i];
+        values5 += static_cast<qoi15::TokenClass>(i) == qoi15::TokenClass::Raw ? 0 : total.counts[i];
+    }
+    EXPECT_EQ(0, values5 % 3);
+    EXPECT_EQ(words * 16, bits + values5 / 3);
+    EXPECT_EQ(noise.size(), total.runPixels + total.GetCount(qoi15::TokenClass::Diff) + total.GetCount(qoi15::TokenClass::Table) +
+                                total.GetCount(qoi15::TokenClass::Raw));
+    EXPECT_GT(total.tableCollisions, 0);
+
+    auto twice = total;
+    twice += total;
+    EXPECT_EQ(total.runPixels * 2, twice.runPixels);
+}
+
+TEST(QOI15Decoder, bulk)
+{
+    //long runs and long chains of small steps
+    std::vector<uint16_t> values(30000);
+    uint32_t seed = 3;
+    uint16_t current = 0x2000;
+    for (auto i = 0; i < 30000; i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        if ((i / 500) % 3 == 0)
+        {
+            current += static_cast<int16_t>((seed >> 16) % 17) - 8;
+        }
+        else if ((seed >> 16) % 200 == 0)
+        {
+            current = static_cast<uint16_t>(seed >> 8);
+        }
+        values[i] = current & 0xFFFE;
+    }
+
+    qoi15::QOI15Encoder<1> encoder(&values[0], values.size());
+    auto [ite1, size1] = encoder.Get();
+
+    qoi15::QOI15Decoder<1> decoder;
+    decoder.Decode(ite1, size1, values.size());
+    auto [ite2, size2] = decoder.Get();
+    EXPECT_EQ(values, std::vector<uint16_t>(ite2, ite2 + size2));
+
+    //stops exactly at the capacity, also inside a word of diffs or a run
+    for (auto capacity : {776, 777, 778, 1000})
+    {
+        std::vector<uint16_t> partial(capacity);
+        decoder.Decode(ite1, size1, &partial[0], partial.size());
+        EXPECT_EQ(std::vector<uint16_t>(values.begin(), values.begin() + partial.size()), partial);
+    }
+
+    //sinks without bulk writes fall back to Write()
+    qoi15::QOI15Decoder<1, qoi15::CountingRepository> counter(ite1, size1, values.size());
+    EXPECT_EQ(static_cast<int>(values.size()), counter.GetRepository().GetSize());
+}
+
 TEST(qoi15, simple)
 {
     std::vector<uint16_t> values =
@@ -237,6 +547,951 @@ TEST(qoi15, runlength)
     }
 }
 
+TEST(qoi15, into)
+{
+    std::vector<uint16_t> values(1000);
+    for (auto i = 0; i < 1000; i++)
+    {
+        values[i] = static_cast<uint16_t>((i / 10) * 6) & 0xFFFE;
+    }
+
+    std::vector<uint16_t> encoded(qoi15::MaxEncodedSize(values.size()));
+    auto size1 = qoi15::EncodeInto(&values[0], values.size(), &encoded[0], encoded.size());
+    EXPECT_LT(size1, encoded.size());
+    EXPECT_THROW(qoi15::EncodeInto(&values[0], values.size(), &encoded[0], values.size() - 1), std::length_error);
+
+    std::vector<uint16_t> decoded(values.size());
+    auto size2 = qoi15::DecodeInto(&encoded[0], size1, &decoded[0], decoded.size());
+    EXPECT_EQ(values.size(), size2);
+    EXPECT_EQ(values, decoded);
+
+    //never writes beyond the capacity
+    std::vector<uint16_t> partial(values.size() / 2 + 1, 0);
+    auto size3 = qoi15::DecodeInto(&encoded[0], size1, &partial[0], values.size() / 2);
+    EXPECT_EQ(values.size() / 2, size3);
+    EXPECT_EQ(0, partial.back());
+
+    //capacities beyond int are clamped, sizes beyond int throw before anything is read
+    auto huge = (static_cast<size_t>(1) << 32) + 10;
+    EXPECT_EQ(values.size(), qoi15::DecodeInto(&encoded[0], size1, &decoded[0], huge));
+    EXPECT_EQ(values, decoded);
+    EXPECT_THROW(qoi15::DecodeInto(&encoded[0], huge, &decoded[0], decoded.size()), std::length_error);
+    EXPECT_THROW(qoi15::EncodeInto(&values[0], huge, &encoded[0], huge), std::length_error);
+    EXPECT_THROW(qoi15::EncodeInto(qoi15::LosslessShift, &values[0], huge, &encoded[0], huge), std::length_error);
+}
+
+TEST(qoi15, shift)
+{
+    std::vector<uint16_t> values(3000);
+    for (auto i = 0; i < 3000; i++)
+    {
+        values[i] = static_cast<uint16_t>(i * 37 + (i / 100) * 1000);
+    }
+
+    qoi15::QOI15Encoder<6> encoder(&values[0], values.size());
+    auto [ite1, size1] = encoder.Get();
+    qoi15::QOI15Decoder<6> decoder(ite1, size1, values.size());
+    auto [ite2, size2] = decoder.Get();
+    EXPECT_EQ(values.size(), size2);
+    for (auto i = 0; i < size2; i++)
+    {
+        EXPECT_EQ(values[i] & 0xFFC0, ite2[i]);
+    }
+
+    std::vector<uint16_t> encoded(qoi15::MaxEncodedSize(values.size()));
+    std::vector<uint16_t> decoded(values.size());
+    for (auto shift = 1; shift <= qoi15::MaxShift; shift++)
+    {
+        auto size3 = qoi15::EncodeInto(shift, &values[0], values.size(), &encoded[0], encoded.size());
+        auto size4 = qoi15::DecodeInto(shift, &encoded[0], size3, &decoded[0], decoded.size());
+        EXPECT_EQ(values.size(), size4);
+        auto mask = static_cast<uint16_t>(0xFFFF << shift);
+        for (size_t i = 0; i < size4; i++)
+        {
+            EXPECT_EQ(values[i] & mask, decoded[i]);
+        }
+    }
+    EXPECT_THROW(qoi15::DecodeInto(-1, &encoded[0], 1, &decoded[0], decoded.size()), std::invalid_argument);
+}
+
+TEST(qoi15, lossless)
+{
+    //full range: a ramp across 0x8000, noise and the extremes
+    std::vector<uint16_t> values(5000);
+    uint32_t seed = 5;
+    for (auto i = 0; i < static_cast<int>(values.size()); i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        auto kind = (i / 500) % 3;
+        values[i] = kind == 0 ? static_cast<uint16_t>(0x7F00 + i % 500) : kind == 1 ? static_cast<uint16_t>(seed >> 16) : (i & 1) != 0 ? 0xFFFF : 0;
+    }
+
+    std::vector<uint16_t> encoded(qoi15::MaxEncodedSize(values.size(), qoi15::LosslessShift));
+    std::vector<uint16_t> decoded(values.size());
+    auto size1 = qoi15::EncodeInto(qoi15::LosslessShift, &values[0], values.size(), &encoded[0], encoded.size());
+    auto size2 = qoi15::DecodeInto(qoi15::LosslessShift, &encoded[0], size1, &decoded[0], decoded.size());
+    EXPECT_EQ(values.size(), size2);
+    EXPECT_EQ(values, decoded);
+    EXPECT_THROW(qoi15::EncodeInto(qoi15::LosslessShift, &values[0], values.size(), &encoded[0], values.size()), std::length_error);
+    EXPECT_THROW(qoi15::DecodeInto(qoi15::LosslessShift, &encoded[0], 1, &decoded[0], decoded.size()), std::runtime_error);
+
+    //an image below 0x8000 costs the shift 1 stream plus a few words
+    std::vector<uint16_t> low(values.size());
+    for (auto i = 0; i < static_cast<int>(low.size()); i++)
+    {
+        low[i] = static_cast<uint16_t>(i * 3 + (i / 100) * 50);
+    }
+    std::vector<uint16_t> shifted(qoi15::MaxEncodedSize(low.size()));
+    auto size3 = qoi15::EncodeInto(1, &low[0], low.size(), &shifted[0], shifted.size());
+    auto size4 = qoi15::EncodeInto(qoi15::LosslessShift, &low[0], low.size(), &encoded[0], encoded.size());
+    EXPECT_GE(size3 + 8, size4);
+    qoi15::DecodeInto(qoi15::LosslessShift, &encoded[0], size4, &decoded[0], decoded.size());
+    EXPECT_EQ(low, decoded);
+
+    std::stringstream stream;
+    qoi15::FileWriter(stream).Write(&values[0], 100, 50, qoi15::LosslessShift);
+    qoi15::FileReader reader(stream);
+    EXPECT_EQ(qoi15::LosslessShift, reader.GetHeader().shift);
+    EXPECT_EQ(values, reader.Read());
+
+    std::stringstream indexed;
+    EXPECT_THROW(qoi15::FileWriter(indexed, true, 10).Write(&values[0], 100, 50, qoi15::LosslessShift), std::invalid_argument);
+}
+
+TEST(StripeEncoder, simple)
+{
+    auto width = 123;
+    auto height = 77;
+    std::vector<uint16_t> values(width * height);
+    for (auto y = 0; y < height; y++)
+    {
+        for (auto x = 0; x < width; x++)
+        {
+            values[y * width + x] = static_cast<uint16_t>((x / 9) * 300 + y * 40) & 0xFFFE;
+        }
+    }
+
+    qoi15::StripeEncoder<1> encoder(4);
+    std::vector<uint16_t> encoded(qoi15::MaxEncodedSize(values.size()));
+    for (auto stripes : {1, 2, 5, 77, 100})
+    {
+        auto size = encoder.Encode(&values[0], width, height, stripes, &encoded[0], encoded.size());
+        const auto &index = encoder.GetIndex();
+        EXPECT_EQ(static_cast<size_t>(std::min(stripes, height)), index.size());
+
+        //every stripe decodes on its own
+        for (size_t i = 0; i < index.size(); i++)
+        {
+            auto wordEnd = i + 1 < index.size() ? index[i + 1].wordOffset : size;
+            auto pixelEnd = i + 1 < index.size() ? index[i + 1].pixelOffset : values.size();
+            std::vector<uint16_t> decoded(pixelEnd - index[i].pixelOffset);
+            auto written = qoi15::DecodeInto(&encoded[index[i].wordOffset], wordEnd - index[i].wordOffset, &decoded[0], decoded.size());
+            EXPECT_EQ(decoded.size(), written);
+            EXPECT_EQ(std::vector<uint16_t>(values.begin() + index[i].pixelOffset, values.begin() + pixelEnd), decoded);
+        }
+    }
+
+    //a single stripe is the plain stream
+    qoi15::QOI15Encoder<1> single(&values[0], values.size());
+    auto [ite, size] = single.Get();
+    auto size1 = encoder.Encode(&values[0], width, height, 1, &encoded[0], encoded.size());
+    EXPECT_EQ(std::vector<uint16_t>(ite, ite + size), std::vector<uint16_t>(encoded.begin(), encoded.begin() + size1));
+}
+
+TEST(StripeDecoder, simple)
+{
+    auto width = 200;
+    auto height = 150;
+    std::vector<uint16_t> values(width * height);
+    uint32_t seed = 11;
+    for (auto i = 0; i < width * height; i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        values[i] = static_cast<uint16_t>((i % width) * 100 + ((seed >> 16) % 8 == 0 ? (seed >> 20) : 0)) & 0xFFFE;
+    }
+
+    qoi15::StripeEncoder<1> encoder(3);
+    qoi15::StripeDecoder<1> decoder(3);
+    std::vector<uint16_t> encoded(qoi15::MaxEncodedSize(values.size()));
+    for (auto stripes : {1, 3, 8, 150})
+    {
+        auto size = encoder.Encode(&values[0], width, height, stripes, &encoded[0], encoded.size());
+
+        std::vector<uint16_t> decoded(values.size());
+        auto written = decoder.Decode(&encoded[0], size, encoder.GetIndex(), &decoded[0], decoded.size());
+        EXPECT_EQ(values.size(), written);
+        EXPECT_EQ(values, decoded);
+    }
+
+    std::vector<qoi15::StripeEntry> broken{{0, 0}, {encoded.size() + 1, 10}};
+    std::vector<uint16_t> decoded(values.size());
+    EXPECT_THROW(decoder.Decode(&encoded[0], encoded.size(), broken, &decoded[0], decoded.size()), std::invalid_argument);
+}
+
+TEST(ThreadPool, exception)
+{
+    qoi15::ThreadPool pool(4);
+    std::atomic<int> started(0);
+    //every index throws, so the calling thread does as well as the workers
+    EXPECT_THROW(pool.Run(1000, [&](int)
+                          {
+                              started++;
+                              throw std::runtime_error("task");
+                          }),
+                 std::runtime_error);
+    EXPECT_GE(pool.GetSize(), started.load());
+
+    EXPECT_THROW(pool.Run(1000, [&](int i)
+                          {
+                              if (i == 500)
+                              {
+                                  throw std::logic_error("task");
+                              }
+                          }),
+                 std::logic_error);
+
+    //still usable after a failed batch
+    std::atomic<int> sum(0);
+    pool.Run(1000, [&](int i) { sum += i; });
+    EXPECT_EQ(999 * 1000 / 2, sum.load());
+}
+
+TEST(Crc32c, simple)
+{
+    std::string text = "123456789";
+    auto data = reinterpret_cast<const uint8_t *>(text.data());
+    EXPECT_EQ(0xE3069283u, qoi15::Crc32c(data, text.size()));
+    EXPECT_EQ(0xE3069283u, qoi15::Crc32c(data + 4, text.size() - 4, qoi15::Crc32c(data, 4)));
+    EXPECT_EQ(0xE3069283u, ~qoi15::Crc32cScalar(data, text.size(), ~0u));
+}
+
+TEST(FileWriter, simple)
+{
+    uint32_t width = 123;
+    uint32_t height = 45;
+    std::vector<uint16_t> values(width * height);
+    for (auto i = 0; i < static_cast<int>(values.size()); i++)
+    {
+        values[i] = static_cast<uint16_t>((i % width) * 300 + (i / width) * 7) & 0xFFF0;
+    }
+
+    for (auto checksum : {false, true})
+    {
+        std::stringstream stream;
+        qoi15::FileWriter writer(stream, checksum);
+        auto bytes = writer.Write(&values[0], width, height, 4);
+        EXPECT_EQ(bytes, stream.str().size());
+
+        qoi15::FileReader reader(stream);
+        auto &header = reader.GetHeader();
+        EXPECT_EQ(width, header.width);
+        EXPECT_EQ(height, header.height);
+        EXPECT_EQ(4, header.shift);
+        EXPECT_EQ(checksum, header.HasChecksum());
+        EXPECT_EQ(values, reader.Read());
+    }
+
+    std::stringstream stream;
+    qoi15::FileWriter(stream).Write(&values[0], width, height, 4);
+    auto corrupted = stream.str();
+    corrupted[qoi15::FileHeader::Size + 10] ^= 1;
+    std::stringstream corruptedStream(corrupted);
+    qoi15::FileReader reader(corruptedStream);
+    EXPECT_THROW(reader.Read(), std::runtime_error);
+
+    std::stringstream truncated(stream.str().substr(0, 20));
+    EXPECT_THROW(qoi15::FileReader{truncated}, std::runtime_error);
+
+    //2^31 pixels do not fit the int counts of the codec, the pixels are never read
+    std::stringstream large;
+    EXPECT_THROW(qoi15::FileWriter(large).Write(&values[0], 65536, 32768, 4), std::invalid_argument);
+    qoi15::FileHeader header;
+    header.width = 65536;
+    header.height = 32768;
+    header.pixels = static_cast<uint64_t>(header.width) * header.height;
+    header.words = 1;
+    std::string bytes(qoi15::FileHeader::Size, '\0');
+    header.Store(reinterpret_cast<uint8_t *>(&bytes[0]));
+    std::stringstream largeHeader(bytes);
+    EXPECT_THROW(qoi15::FileReader{largeHeader}, std::runtime_error);
+}
+
+TEST(QOI15Decoder, restart)
+{
+    std::vector<uint16_t> values(5000);
+    uint32_t seed = 3;
+    for (auto i = 0; i < static_cast<int>(values.size()); i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        auto kind = (i / 300) % 3;
+        values[i] = static_cast<uint16_t>(kind == 0 ? 1000 : (kind == 1 ? i * 6 : (seed >> 16))) & 0xFFFE;
+    }
+
+    qoi15::QOI15Encoder<1> plain(&values[0], static_cast<int>(values.size()));
+    auto [plainData, plainSize] = plain.Get();
+
+    for (auto interval : {1, 7, 100, 256, 5000})
+    {
+        std::vector<uint16_t> encoded(qoi15::MaxEncodedSize(values.size()));
+        std::vector<qoi15::RestartPoint> points;
+        qoi15::QOI15Encoder<1> encoder;
+        encoder.Encode(&values[0], static_cast<int>(values.size()), &encoded[0], interval, points);
+        auto [data, size] = encoder.Get();
+        EXPECT_EQ(plainSize, size);
+        EXPECT_TRUE(std::equal(data, data + size, plainData));
+        EXPECT_EQ((values.size() + interval - 1) / interval, points.size());
+
+        qoi15::QOI15Decoder<1> decoder;
+        for (auto i = 0; i < static_cast<int>(points.size()); i++)
+        {
+            auto &point = points[i];
+            EXPECT_LE(point.pixelOffset, static_cast<uint64_t>(i * interval));
+
+            std::vector<uint16_t> decoded(values.size() - point.pixelOffset);
+            decoder.Decode(data, size, point, &decoded[0], static_cast<int>(decoded.size()));
+            EXPECT_EQ(static_cast<int>(decoded.size()), std::get<1>(decoder.Get()));
+            EXPECT_TRUE(std::equal(decoded.begin(), decoded.end(), values.begin() + point.pixelOffset));
+        }
+    }
+}
+
+TEST(FileReader, rows)
+{
+    uint32_t width = 64;
+    uint32_t height = 100;
+    std::vector<uint16_t> values(width * height);
+    for (auto i = 0; i < static_cast<int>(values.size()); i++)
+    {
+        auto y = i / width;
+        values[i] = static_cast<uint16_t>(y % 10 < 4 ? 500 : (i * 37) % 4096) & 0xFFFC;
+    }
+
+    std::stringstream stream;
+    qoi15::FileWriter(stream, true, 8).Write(&values[0], width, height, 2);
+
+    qoi15::FileReader reader(stream);
+    EXPECT_TRUE(reader.GetHeader().HasIndex());
+    for (auto [y0, y1] : std::vector<std::pair<uint32_t, uint32_t>>{{0, 1}, {3, 9}, {8, 16}, {40, 41}, {95, 100}, {0, 100}})
+    {
+        std::vector<uint16_t> rows((y1 - y0) * width);
+        EXPECT_EQ(rows.size(), reader.ReadRows(y0, y1, &rows[0], rows.size()));
+        EXPECT_TRUE(std::equal(rows.begin(), rows.end(), values.begin() + y0 * width));
+    }
+    EXPECT_EQ(values, reader.Read());
+    EXPECT_THROW(reader.ReadRows(5, 101, nullptr, 0), std::invalid_argument);
+}
+
+TEST(StreamEncoder, simple)
+{
+    auto width = 37;
+    auto height = 50;
+    size_t stride = 40;
+    std::vector<uint16_t> values(width * height);
+    std::vector<uint16_t> padded(stride * height, 0x1234);
+    uint32_t seed = 5;
+    for (auto i = 0; i < width * height; i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        auto y = i / width;
+        values[i] = static_cast<uint16_t>(y % 5 == 0 ? 700 : (y % 5 == 1 ? (seed >> 16) : i * 3)) & 0xFFFE;
+        padded[y * stride + i % width] = values[i];
+    }
+    qoi15::QOI15Encoder<1> encoder(&values[0], width * height);
+    auto [data, size] = encoder.Get();
+    std::vector<uint16_t> expected(data, data + size);
+
+    std::vector<uint16_t> encoded;
+    auto calls = 0;
+    qoi15::StreamEncoder<1> stream(width, [&](const uint16_t *words, size_t count)
+                                   {
+                                       encoded.insert(encoded.end(), words, words + count);
+                                       calls++;
+                                   });
+    for (auto frame = 0; frame < 2; frame++)
+    {
+        encoded.clear();
+        auto y = 0;
+        for (auto rows : {1, 3, 0, 7, 1, 20, 18})
+        {
+            stream.PushRows(&padded[y * stride], rows, stride);
+            y += rows;
+        }
+        EXPECT_EQ(height, y);
+        EXPECT_EQ(expected.size(), stream.Finish());
+        EXPECT_EQ(expected, encoded);
+    }
+    EXPECT_GT(calls, 4);
+}
+
+TEST(StreamDecoder, simple)
+{
+    std::vector<uint16_t> values(3000);
+    uint32_t seed = 9;
+    for (auto i = 0; i < static_cast<int>(values.size()); i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        auto kind = (i / 100) % 4;
+        values[i] = static_cast<uint16_t>(kind == 0 ? 4000 : (kind == 1 ? i * 4 : (kind == 2 ? (seed >> 16) : (seed >> 28) * 2))) & 0xFFFE;
+    }
+    qoi15::QOI15Encoder<1> encoder(&values[0], static_cast<int>(values.size()));
+    auto [data, size] = encoder.Get();
+    std::vector<uint8_t> bytes;
+    for (auto i = 0; i < size; i++)
+    {
+        bytes.push_back(static_cast<uint8_t>(data[i]));
+        bytes.push_back(static_cast<uint8_t>(data[i] >> 8));
+    }
+    bytes.push_back(0xAB);
+
+    qoi15::StreamDecoder<1> decoder;
+    for (auto maxChunk : {1, 2, 5, 64, 100000})
+    {
+        decoder.Reset(values.size());
+        std::vector<uint16_t> decoded(values.size());
+        size_t consumed = 0;
+        size_t produced = 0;
+        auto calls = 0;
+        while (!decoder.IsDone())
+        {
+            seed = seed * 1664525 + 1013904223;
+            auto inputSize = std::min<size_t>(bytes.size() - consumed, (seed >> 8) % maxChunk + 1);
+            auto outputSize = std::min<size_t>(decoded.size() - produced, (seed >> 20) % (maxChunk * 2));
+            auto result = decoder.Decode(&bytes[consumed], inputSize, &decoded[produced], outputSize);
+            consumed += result.consumed;
+            produced += result.produced;
+            EXPECT_EQ(decoder.IsDone(), result.done);
+            ASSERT_LT(calls++, 100000);
+        }
+        EXPECT_EQ(values.size(), produced);
+        EXPECT_EQ(values, decoded);
+        EXPECT_EQ(static_cast<size_t>(size) * 2, consumed);
+    }
+}
+
+TEST(SequenceReader, simple)
+{
+    uint32_t width = 40;
+    uint32_t height = 30;
+    auto frame = [&](int n)
+    {
+        std::vector<uint16_t> values(width * height);
+        for (auto i = 0; i < static_cast<int>(values.size()); i++)
+        {
+            values[i] = static_cast<uint16_t>((i % width) * 50 + n * 1000) & 0xFFFE;
+        }
+        return values;
+    };
+    auto path = (std::filesystem::temp_directory_path() / "qoi15_sequence_test.q15s").string();
+
+    {
+        qoi15::SequenceWriter writer(path, true, false);
+        for (auto n = 0; n < 5; n++)
+        {
+            EXPECT_EQ(static_cast<size_t>(n), writer.Append(&frame(n)[0], width, height, 1, n * 100, n == 0 ? 1 : 0));
+        }
+    }
+    {
+        qoi15::SequenceWriter writer(path);
+        EXPECT_EQ(5u, writer.GetFrameCount());
+        writer.Append(&frame(5)[0], width, height, 1, 500);
+    }
+
+    qoi15::SequenceReader reader(path);
+    EXPECT_EQ(6u, reader.GetFrameCount());
+    EXPECT_EQ(300u, reader.GetEntry(3).timestamp);
+    EXPECT_EQ(1u, reader.GetEntry(0).flags);
+    EXPECT_EQ(width, reader.GetFrameHeader(2).width);
+
+    std::vector<std::thread> threads;
+    std::atomic<int> failures(0);
+    for (auto t = 0; t < 3; t++)
+    {
+        threads.emplace_back([&, t]()
+                             {
+                                 for (auto n = 5 - t; n >= 0; n--)
+                                 {
+                                     failures += reader.ReadFrame(n) != frame(n);
+                                 }
+                             });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    EXPECT_EQ(0, failures);
+    EXPECT_THROW(reader.ReadFrame(6), std::out_of_range);
+
+    std::filesystem::remove(path);
+}
+
+TEST(SequenceReader, unclosed)
+{
+    uint32_t width = 40;
+    uint32_t height = 30;
+    auto frame = [&](int n)
+    {
+        std::vector<uint16_t> values(width * height);
+        for (auto i = 0; i < static_cast<int>(values.size()); i++)
+        {
+            values[i] = static_cast<uint16_t>((i % width) * 50 + (i / width) * n * 7 + n * 1000) & 0xFFFE;
+        }
+        return values;
+    };
+    auto path = (std::filesystem::temp_directory_path() / "qoi15_unclosed_test.q15s").string();
+
+    {
+        qoi15::SequenceWriter writer(path, true, false, 2);
+        for (auto n = 0; n < 3; n++)
+        {
+            writer.Append(&frame(n)[0], width, height, 1, n * 100 + 1);
+        }
+        writer.Flush();
+
+        //a reader opened while recording keeps its frames when the next index is written
+        qoi15::SequenceReader early(path);
+        EXPECT_EQ(3u, early.GetFrameCount());
+        for (auto n = 3; n < 5; n++)
+        {
+            writer.Append(&frame(n)[0], width, height, 1, n * 100 + 1);
+        }
+        writer.Flush();
+        EXPECT_EQ(frame(2), early.ReadFrame(2));
+        EXPECT_EQ(201u, early.GetEntry(2).timestamp);
+    }
+    auto size = std::filesystem::file_size(path);
+    {
+        qoi15::SequenceWriter writer(path);
+        EXPECT_EQ(5u, writer.GetFrameCount());
+    }
+    EXPECT_EQ(size, std::filesystem::file_size(path));
+
+    //without the last index the frames behind the first index are found from their headers
+    std::filesystem::resize_file(path, size - 5 * qoi15::SequenceEntry::Size - qoi15::SequenceLayout::FooterSize);
+    {
+        qoi15::SequenceReader reader(path);
+        ASSERT_EQ(5u, reader.GetFrameCount());
+        EXPECT_EQ(201u, reader.GetEntry(2).timestamp);
+        EXPECT_EQ(0u, reader.GetEntry(3).timestamp);
+        EXPECT_TRUE(reader.GetEntry(3).temporal);
+        for (auto n = 0; n < 5; n++)
+        {
+            EXPECT_EQ(frame(n), reader.ReadFrame(n));
+        }
+    }
+
+    //a frame cut short by a crash is dropped and overwritten by the next one
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 10);
+    EXPECT_EQ(4u, qoi15::SequenceReader(path).GetFrameCount());
+    {
+        qoi15::SequenceWriter writer(path, true, true, 2);
+        EXPECT_EQ(4u, writer.GetFrameCount());
+        writer.Append(&frame(5)[0], width, height, 1, 501);
+    }
+    qoi15::SequenceReader reader(path);
+    ASSERT_EQ(5u, reader.GetFrameCount());
+    EXPECT_FALSE(reader.GetEntry(4).temporal);
+    EXPECT_EQ(501u, reader.GetEntry(4).timestamp);
+    for (auto n = 0; n < 4; n++)
+    {
+        EXPECT_EQ(frame(n), reader.ReadFrame(n));
+    }
+    EXPECT_EQ(frame(5), reader.ReadFrame(4));
+
+    std::filesystem::remove(path);
+}
+
+TEST(SequenceReader, temporal)
+{
+    uint32_t width = 64;
+    uint32_t height = 48;
+    std::vector<std::vector<uint16_t>> frames;
+    uint32_t seed = 17;
+    std::vector<uint16_t> scene(width * height);
+    for (auto i = 0; i < static_cast<int>(scene.size()); i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        scene[i] = static_cast<uint16_t>(seed >> 16);
+    }
+    for (auto n = 0; n < 10; n++)
+    {
+        //a static noisy scene with a little sensor noise and a moving spot
+        auto frame = scene;
+        for (auto i = 0; i < static_cast<int>(frame.size()); i++)
+        {
+            seed = seed * 1664525 + 1013904223;
+            if ((seed >> 16) % 8 == 0)
+            {
+                frame[i] = static_cast<uint16_t>(frame[i] + ((seed >> 20) % 2) * 4 - 2);
+            }
+        }
+        frame[n * 100] = 0;
+        frames.push_back(frame);
+    }
+
+    std::vector<uint16_t> residual(width * height);
+    std::vector<uint16_t> restored(width * height);
+    for (auto shift : {0, 1, 7, 15})
+    {
+        qoi15::ToTemporalResidual(&frames[1][0], &frames[0][0], &residual[0], residual.size(), shift);
+        qoi15::FromTemporalResidual(&residual[0], &frames[0][0], &restored[0], restored.size(), shift);
+        for (auto i = 0; i < static_cast<int>(restored.size()); i++)
+        {
+            EXPECT_EQ(static_cast<uint16_t>(frames[1][i] >> shift << shift), restored[i]);
+        }
+    }
+
+    std::vector<uint64_t> sizes;
+    for (auto keyInterval : {1, 4})
+    {
+        auto path = (std::filesystem::temp_directory_path() / "qoi15_temporal_test.q15s").string();
+        {
+            qoi15::SequenceWriter writer(path, true, false, keyInterval);
+            for (auto &frame : frames)
+            {
+                writer.Append(&frame[0], width, height, 1);
+            }
+        }
+
+        qoi15::SequenceReader reader(path);
+        uint64_t size = 0;
+        for (auto n = 0; n < static_cast<int>(frames.size()); n++)
+        {
+            EXPECT_EQ(keyInterval > 1 && n % keyInterval != 0, reader.GetEntry(n).temporal);
+            size += reader.GetEntry(n).size;
+
+            auto decoded = reader.ReadFrame(n);
+            for (auto i = 0; i < static_cast<int>(decoded.size()); i++)
+            {
+                ASSERT_EQ(static_cast<uint16_t>(frames[n][i] & 0xFFFE), decoded[i]);
+            }
+        }
+        sizes.push_back(size);
+        std::filesystem::remove(path);
+    }
+    EXPECT_LT(sizes[1] * 2, sizes[0]);
+}
+
+#ifdef QOI15_MMAP
+TEST(MappedFileReader, simple)
+{
+    uint32_t width = 300;
+    uint32_t height = 70;
+    std::vector<uint16_t> values(width * height);
+    for (auto i = 0; i < static_cast<int>(values.size()); i++)
+    {
+        values[i] = static_cast<uint16_t>((i % width) / 10 * 90 + (i / width) * 5) & 0xFFF8;
+    }
+    auto path = (std::filesystem::temp_directory_path() / "qoi15_mapped_test.qoi15").string();
+
+    qoi15::MappedFileWriter writer(true, 16);
+    auto size = writer.Write(path, &values[0], width, height, 3);
+    EXPECT_EQ(size, std::filesystem::file_size(path));
+    {
+        qoi15::MappedFileReader reader(path);
+        EXPECT_EQ(width, reader.GetHeader().width);
+        std::vector<uint16_t> decoded(values.size());
+        EXPECT_EQ(values.size(), reader.Read(&decoded[0], decoded.size()));
+        EXPECT_EQ(values, decoded);
+    }
+
+    //both writers produce the same file
+    std::stringstream stream;
+    qoi15::FileWriter(stream, true, 16).Write(&values[0], width, height, 3);
+    std::ifstream file(path, std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    EXPECT_EQ(stream.str(), bytes);
+    file.close();
+
+    //rejected frames leave an existing file as it was
+    EXPECT_THROW(writer.Write(path, &values[0], width, height, 16), std::invalid_argument);
+    EXPECT_THROW(writer.Write(path, &values[0], width, height, -1), std::invalid_argument);
+    EXPECT_THROW(writer.Write(path, &values[0], width, height, qoi15::LosslessShift), std::invalid_argument);
+    EXPECT_THROW(writer.Write(path, &values[0], 65536, 32768, 3), std::invalid_argument);
+    std::ifstream unchanged(path, std::ios::binary);
+    EXPECT_EQ(bytes, std::string((std::istreambuf_iterator<char>(unchanged)), std::istreambuf_iterator<char>()));
+    unchanged.close();
+
+    std::filesystem::remove(path);
+    EXPECT_THROW(qoi15::MappedFileReader{path}, std::system_error);
+}
+#endif
+
+TEST(FileReader, med)
+{
+    uint32_t width = 90;
+    uint32_t height = 60;
+    std::vector<uint16_t> values(width * height);
+    for (auto i = 0; i < static_cast<int>(values.size()); i++)
+    {
+        auto x = static_cast<int>(i % width);
+        auto y = static_cast<int>(i / width);
+        values[i] = static_cast<uint16_t>(x * x * 3 + y * 200 + ((x + y) % 7) * 16);
+    }
+
+    for (auto indexRows : {0, 8})
+    {
+        std::stringstream stream;
+        qoi15::FileWriter(stream, true, indexRows, qoi15::Prediction::Med).Write(&values[0], width, height, 2);
+        qoi15::FileReader reader(stream);
+        EXPECT_TRUE(reader.GetHeader().IsMed());
+        auto decoded = reader.Read();
+        for (auto i = 0; i < static_cast<int>(values.size()); i++)
+        {
+            ASSERT_EQ(static_cast<uint16_t>(values[i] & 0xFFFC), decoded[i]);
+        }
+        if (indexRows != 0)
+        {
+            std::vector<uint16_t> rows(13 * width);
+            reader.ReadRows(21, 34, &rows[0], rows.size());
+            EXPECT_TRUE(std::equal(rows.begin(), rows.end(), decoded.begin() + 21 * width));
+        }
+    }
+}
+
+TEST(LowBits, simple)
+{
+    std::vector<uint16_t> values(1001);
+    uint32_t seed = 11;
+    for (auto &value : values)
+    {
+        seed = seed * 1664525 + 1013904223;
+        value = static_cast<uint16_t>(seed >> 16);
+    }
+
+    for (auto shift = 1; shift <= qoi15::MaxShift; shift++)
+    {
+        //bit by bit reference, pixel 0 in the lowest bits
+        std::vector<uint16_t> expected(qoi15::LowBitsSize(values.size(), shift));
+        for (size_t i = 0; i < values.size() * shift; i++)
+        {
+            auto bit = (values[i / shift] >> (i % shift)) & 1;
+            expected[i / 16] |= static_cast<uint16_t>(bit << (i % 16));
+        }
+
+        std::vector<uint16_t> packed(expected.size());
+        EXPECT_EQ(expected.size(), qoi15::PackLowBits(&values[0], values.size(), &packed[0], shift));
+        EXPECT_EQ(expected, packed);
+
+        auto mask = static_cast<uint16_t>(0xFFFF << shift);
+        std::vector<uint16_t> merged(values.size());
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            merged[i] = values[i] & mask;
+        }
+        qoi15::UnpackLowBits(&packed[0], packed.size(), &merged[0], merged.size(), shift);
+        EXPECT_EQ(values, merged);
+        EXPECT_THROW(qoi15::UnpackLowBits(&packed[0], packed.size() - 1, &merged[0], merged.size(), shift), std::runtime_error);
+    }
+}
+
+TEST(FileReader, lowbits)
+{
+    uint32_t width = 90;
+    uint32_t height = 60;
+    std::vector<uint16_t> values(width * height);
+    for (auto i = 0; i < static_cast<int>(values.size()); i++)
+    {
+        values[i] = static_cast<uint16_t>((i % width) * 500 + (i / width) * 3 + (i * 7919) % 61);
+    }
+
+    for (auto prediction : {qoi15::Prediction::None, qoi15::Prediction::Med})
+    {
+        std::stringstream stream;
+        auto bytes = qoi15::FileWriter(stream, true, 8, prediction, qoi15::DefaultLayout, true).Write(&values[0], width, height, 6);
+        EXPECT_EQ(bytes, stream.str().size());
+
+        qoi15::FileReader reader(stream);
+        EXPECT_TRUE(reader.GetHeader().HasLowBits());
+        auto coarse = reader.Read();
+        for (auto i = 0; i < static_cast<int>(values.size()); i++)
+        {
+            ASSERT_EQ(static_cast<uint16_t>(values[i] & 0xFFC0), coarse[i]);
+        }
+        EXPECT_EQ(values, reader.ReadExact());
+
+        auto corrupted = stream.str();
+        corrupted[corrupted.size() - 10] ^= 1;
+        std::stringstream corruptedStream(corrupted);
+        qoi15::FileReader corruptedReader(corruptedStream);
+        EXPECT_EQ(coarse, corruptedReader.Read());
+        EXPECT_THROW(corruptedReader.ReadExact(), std::runtime_error);
+    }
+
+    //without a checksum the low bits end the file
+    std::stringstream unchecked;
+    auto uncheckedBytes = qoi15::FileWriter(unchecked, false, 0, qoi15::Prediction::None, qoi15::DefaultLayout, true).Write(&values[0], width, height, 6);
+    EXPECT_EQ(uncheckedBytes, unchecked.str().size());
+    qoi15::FileReader uncheckedReader(unchecked);
+    EXPECT_FALSE(uncheckedReader.GetHeader().HasChecksum());
+    EXPECT_EQ(values, uncheckedReader.ReadExact());
+
+    std::stringstream stream;
+    qoi15::FileWriter(stream).Write(&values[0], width, height, 6);
+    qoi15::FileReader reader(stream);
+    EXPECT_THROW(reader.ReadExact(), std::runtime_error);
+}
+
+TEST(qoi15, med)
+{
+    std::vector<std::string> paths{
+        "Tests/Images/cat1.jpg",
+        "Tests/Images/cat2.jpg",
+        "Tests/Images/cat3.jpg",
+        "Tests/Images/cat4.jpg",
+        "Tests/Images/cat5.jpg",
+        "Tests/Images/cat6.jpg",
+        "Tests/Images/cat7.jpg"};
+
+    //the MED stream is smaller than the plain one, qoi15bench has the time of both
+    size_t plainSize = 0;
+    size_t medSize = 0;
+    for (const auto &path : paths)
+    {
+        PNG16 png(path);
+        auto mat = png.Get();
+        auto buffer = reinterpret_cast<const uint16_t *>(mat.data);
+        auto width = static_cast<size_t>(mat.cols);
+        auto height = static_cast<size_t>(mat.rows);
+        std::vector<uint16_t> residual(width * height);
+        std::vector<uint16_t> encoded(qoi15::MaxEncodedSize(width * height));
+        std::vector<uint16_t> decoded(width * height);
+
+        plainSize += qoi15::EncodeInto<6>(buffer, width * height, &encoded[0], encoded.size());
+        qoi15::ToMedResidual(buffer, &residual[0], width, height, 6);
+        auto size = qoi15::EncodeInto<6>(&residual[0], width * height, &encoded[0], encoded.size());
+        medSize += size;
+
+        qoi15::DecodeInto<6>(&encoded[0], size, &decoded[0], decoded.size());
+        qoi15::FromMedResidual(&decoded[0], &decoded[0], width, height, 6);
+        for (size_t i = 0; i < decoded.size(); i++)
+        {
+            ASSERT_EQ(static_cast<uint16_t>(buffer[i] >> 6 << 6), decoded[i]);
+        }
+    }
+    EXPECT_LT(medSize, plainSize);
+
+    //a smooth bowl with residuals of both signs, which must not reach the MSB stream of a lossless payload
+    size_t width = 256;
+    size_t height = 192;
+    std::vector<uint16_t> smooth(width * height);
+    uint32_t seed = 5;
+    for (size_t i = 0; i < smooth.size(); i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        auto dx = static_cast<int>(i % width) - 128;
+        auto dy = static_cast<int>(i / width) - 96;
+        smooth[i] = static_cast<uint16_t>(30000 + (dx * dx + dy * dy) / 4 + (seed >> 16) % 7);
+    }
+    std::vector<uint16_t> residual(smooth.size());
+    std::vector<uint16_t> encoded(qoi15::MaxEncodedSize(smooth.size(), qoi15::LosslessShift));
+    std::vector<uint16_t> decoded(smooth.size());
+    auto plain = qoi15::EncodeInto<qoi15::LosslessShift>(&smooth[0], smooth.size(), &encoded[0], encoded.size());
+    qoi15::ToMedResidual(&smooth[0], &residual[0], width, height, qoi15::LosslessShift);
+    auto med = qoi15::EncodeInto<qoi15::LosslessShift>(&residual[0], residual.size(), &encoded[0], encoded.size());
+    EXPECT_LT(med * 2, plain);
+    qoi15::DecodeInto<qoi15::LosslessShift>(&encoded[0], med, &decoded[0], decoded.size());
+    qoi15::FromMedResidual(&decoded[0], &decoded[0], width, height, qoi15::LosslessShift);
+    EXPECT_EQ(smooth, decoded);
+}
+
+TEST(QOI15Decoder, rowcopy)
+{
+    //a textured mask whose rows mostly repeat the row above
+    auto width = 173;
+    auto height = 80;
+    std::vector<uint16_t> values(width * height);
+    uint32_t seed = 23;
+    for (auto i = 0; i < width * height; i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        auto x = i % width;
+        auto y = i / width;
+        values[i] = i < width || (y % 9 == 0 && x > 50) ? static_cast<uint16_t>(seed >> 16) : values[i - width];
+        if (y % 13 == 5 && x < 20)
+        {
+            values[i] = 1234;
+        }
+    }
+
+    qoi15::QOI15Encoder<1> plain(&values[0], width * height);
+    qoi15::QOI15Encoder<1, qoi15::SpeedFirstRepository, qoi15::Layout::RowCopy> encoder;
+    qoi15::QOI15Decoder<1, qoi15::SpeedFirstRepository, qoi15::Layout::RowCopy> decoder;
+    for (auto level : {qoi15::SimdLevel::Scalar, qoi15::SimdLevel::AVX2})
+    {
+        encoder.SetWidth(width);
+        encoder.SetSimdLevel(level);
+        encoder.Encode(&values[0], width * height);
+        auto [data, size] = encoder.Get();
+        EXPECT_LT(size * 4, std::get<1>(plain.Get()));
+
+        decoder.SetWidth(width);
+        decoder.Decode(data, size, width * height);
+        auto [decoded, decodedSize] = decoder.Get();
+        ASSERT_EQ(width * height, decodedSize);
+        for (auto i = 0; i < width * height; i++)
+        {
+            ASSERT_EQ(static_cast<uint16_t>(values[i] & 0xFFFE), decoded[i]);
+        }
+    }
+
+    std::stringstream stream;
+    qoi15::FileWriter(stream, true, 0, qoi15::Prediction::None, qoi15::Layout::RowCopy).Write(&values[0], width, height, 1);
+    qoi15::FileReader reader(stream);
+    EXPECT_EQ(qoi15::Layout::RowCopy, reader.GetHeader().layout);
+    auto decoded = reader.Read();
+    for (auto i = 0; i < width * height; i++)
+    {
+        ASSERT_EQ(static_cast<uint16_t>(values[i] & 0xFFFE), decoded[i]);
+    }
+}
+
+TEST(SyntheticImage, simple)
+{
+    for (auto kind : qoi15::GetSyntheticKinds())
+    {
+        qoi15::SyntheticImage image(kind, 300, 200, 42);
+        auto pixels = image.Generate();
+        EXPECT_EQ(pixels, qoi15::SyntheticImage(kind, 300, 200, 42).Generate());
+        EXPECT_NE(pixels, qoi15::SyntheticImage(kind, 300, 200, 43).Generate());
+
+        //rows do not depend on the rows before them
+        std::vector<uint16_t> rows(300 * 50);
+        image.GenerateRows(120, 170, &rows[0]);
+        EXPECT_TRUE(std::equal(rows.begin(), rows.end(), pixels.begin() + 120 * 300));
+
+        std::vector<uint16_t> encoded(qoi15::MaxEncodedSize(pixels.size(), qoi15::LosslessShift));
+        std::vector<uint16_t> decoded(pixels.size());
+        auto words = qoi15::EncodeInto(qoi15::LosslessShift, &pixels[0], pixels.size(), &encoded[0], encoded.size());
+        qoi15::DecodeInto(qoi15::LosslessShift, &encoded[0], words, &decoded[0], decoded.size());
+        EXPECT_EQ(pixels, decoded) << qoi15::GetSyntheticName(kind);
+    }
+
+    auto depth = qoi15::SyntheticImage(qoi15::SyntheticKind::Depth, 256, 256).Generate();
+    EXPECT_NE(depth.end(), std::find(depth.begin(), depth.end(), 0));
+    auto panel = qoi15::SyntheticImage(qoi15::SyntheticKind::MaskedPanel, 600, 600).Generate();
+    EXPECT_NE(panel.end(), std::find(panel.begin(), panel.end(), 0));
+    EXPECT_NE(panel.end(), std::find(panel.begin(), panel.end(), 65535));
+    EXPECT_THROW(qoi15::SyntheticImage(qoi15::SyntheticKind::Sensor, 0, 10), std::invalid_argument);
+}
+
+TEST(SyntheticImage, hash)
+{
+    //frames are integer arithmetic, a change of these checksums changes every benchmark input
+    std::vector<uint32_t> expected{0x93D23C8Cu, 0x97CDE024u, 0xB012A2C5u, 0xC3DAD7C1u, 0x3EAF66F2u};
+    for (size_t i = 0; i < expected.size(); i++)
+    {
+        auto kind = qoi15::GetSyntheticKinds()[i];
+        auto pixels = qoi15::SyntheticImage(kind, 257, 131, 42).Generate();
+        std::vector<uint8_t> bytes;
+        for (auto value : pixels)
+        {
+            bytes.push_back(static_cast<uint8_t>(value));
+            bytes.push_back(static_cast<uint8_t>(value >> 8));
+        }
+        EXPECT_EQ(expected[i], qoi15::Crc32c(&bytes[0], bytes.size())) << qoi15::GetSyntheticName(kind);
+    }
+}
+
 TEST(qoi15, image)
 {
     PNG16 png("Tests/Images/cat1.jpg");
@@ -298,7 +1553,6 @@ TEST(qoi15, size)
         qoi15::QOI15Encoder<6> encoder((uint16_t *)(pngMat.data), pngMat.cols * pngMat.rows);
         auto [_, size] = encoder.Get();
         //std::cout << size << "/" << pngMat.cols * pngMat.rows << " = " << (float)size / (pngMat.cols * pngMat.rows) << std::endl;
-        //encoder.ShowStatics();
         EXPECT_LT((float)size / (pngMat.cols * pngMat.rows), 1);
     }
 }
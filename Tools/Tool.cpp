@@ -0,0 +1,621 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <qoi15.hpp>
+#include <qoi15synthetic.hpp>
+#include <opencv2/opencv.hpp>
+
+namespace fs = std::filesystem;
+
+static const char *usage =
+    "usage: qoi15 encode [options] <input> [output]\n"
+    "       qoi15 decode [options] <input> [output]\n"
+    "       qoi15 bench [options] [input...]\n"
+    "\n"
+    "encode converts 16bit mono PNG/TIFF/PGM into .qoi15 files, decode converts them back.\n"
+    "An input directory is converted with all its subdirectories into the output directory,\n"
+    "which defaults to the input. Existing outputs are never replaced without --overwrite. bench encodes and decodes each image in memory and reports\n"
+    "MB/s of 16bit pixels, without inputs it uses the synthetic frames of qoi15synthetic.hpp.\n"
+    "\n"
+    "options:\n"
+    "  --shift=N        dropped low bits, 0 is lossless (default 1)\n"
+    "  --low-bits       keeps the dropped bits in the file so decode restores them\n"
+    "  --med            MED spatial prediction\n"
+    "  --row-copy       row copy token layout\n"
+    "  --index-rows=N   restart point every N rows\n"
+    "  --no-checksum    no CRC32C of the payload\n"
+    "  --format=EXT     image format decode writes into directories, png or tiff (default png)\n"
+    "  --overwrite      replaces outputs that exist, which are kept otherwise\n"
+    "  --threads=N      workers of a directory conversion, 0 is every hardware thread (default 0)\n"
+    "  --memory=MB      pixels and buffers the workers hold at once (default 1024)\n"
+    "  --seconds=S      time bench spends on each direction of each image (default 1)\n"
+    "  --size=N         side of the synthetic bench frames (default 1024)\n";
+
+struct Options
+{
+    int shift = 1;
+    bool lowBits = false;
+    qoi15::Prediction prediction = qoi15::Prediction::None;
+    qoi15::Layout layout = qoi15::DefaultLayout;
+    int indexRows = 0;
+    bool checksum = true;
+    std::string format = "png";
+    bool overwrite = false;
+    int threads = 0;
+    size_t memory = size_t(1024) << 20;
+    double seconds = 1.0;
+    int size = 1024;
+    std::vector<std::string> paths;
+};
+
+//throws std::invalid_argument for anything usage should be shown for
+static Options parseOptions(const std::vector<std::string> &args)
+{
+    Options options;
+    for (const auto &arg : args)
+    {
+        auto equal = arg.find('=');
+        auto name = arg.substr(0, equal);
+        auto value = equal == std::string::npos ? std::string() : arg.substr(equal + 1);
+        if (name.rfind("--", 0) != 0)
+        {
+            options.paths.push_back(arg);
+        }
+        else if (name == "--shift")
+        {
+            options.shift = std::stoi(value);
+            if (options.shift < qoi15::LosslessShift || options.shift > qoi15::MaxShift)
+            {
+                throw std::invalid_argument("shift must be 0 to 15");
+            }
+        }
+        else if (name == "--low-bits")
+        {
+            options.lowBits = true;
+        }
+        else if (name == "--med")
+        {
+            options.prediction = qoi15::Prediction::Med;
+        }
+        else if (name == "--row-copy")
+        {
+            options.layout = qoi15::Layout::RowCopy;
+        }
+        else if (name == "--index-rows")
+        {
+            options.indexRows = std::stoi(value);
+        }
+        else if (name == "--no-checksum")
+        {
+            options.checksum = false;
+        }
+        else if (name == "--format")
+        {
+            if (value != "png" && value != "tiff")
+            {
+                throw std::invalid_argument("format must be png or tiff");
+            }
+            options.format = value;
+        }
+        else if (name == "--overwrite")
+        {
+            options.overwrite = true;
+        }
+        else if (name == "--threads")
+        {
+            options.threads = std::max(std::stoi(value), 0);
+        }
+        else if (name == "--memory")
+        {
+            options.memory = static_cast<size_t>(std::max(std::stoll(value), 1LL)) << 20;
+        }
+        else if (name == "--seconds")
+        {
+            options.seconds = std::stod(value);
+        }
+        else if (name == "--size")
+        {
+            options.size = std::stoi(value);
+        }
+        else
+        {
+            throw std::invalid_argument("unknown option " + arg);
+        }
+    }
+    return options;
+}
+
+//blocks Acquire() while the jobs in flight would go over the limit, a job larger than the limit runs alone
+class MemoryBudget
+{
+    std::mutex mutex_;
+    std::condition_variable released_;
+    size_t limit_;
+    size_t used_;
+
+public:
+    explicit MemoryBudget(const size_t limit)
+        : limit_(limit), used_(0)
+    {
+    }
+
+    void Acquire(const size_t bytes)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        released_.wait(lock, [&]() { return used_ == 0 || used_ + bytes <= limit_; });
+        used_ += bytes;
+    }
+
+    void Release(const size_t bytes)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            used_ -= bytes;
+        }
+        released_.notify_all();
+    }
+};
+
+//releases what it acquired when the job leaves its scope, also by an exception
+class Reservation
+{
+    MemoryBudget &budget_;
+    size_t bytes_;
+
+public:
+    Reservation(MemoryBudget &budget, const size_t bytes)
+        : budget_(budget), bytes_(bytes)
+    {
+        budget_.Acquire(bytes_);
+    }
+
+    Reservation(const Reservation &) = delete;
+
+    ~Reservation()
+    {
+        budget_.Release(bytes_);
+    }
+};
+
+static std::string lowerExtension(const fs::path &path)
+{
+    auto extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return extension;
+}
+
+static bool isImage(const fs::path &path)
+{
+    auto extension = lowerExtension(path);
+    return extension == ".png" || extension == ".tif" || extension == ".tiff" || extension == ".pgm";
+}
+
+static bool isEncoded(const fs::path &path)
+{
+    return lowerExtension(path) == ".qoi15";
+}
+
+//pixels of an image before it is decoded, from the PNG header or else as an uncompressed 16bit TIFF/PGM
+static uint64_t peekPixels(const fs::path &path)
+{
+    std::ifstream stream(path, std::ios::binary);
+    std::array<uint8_t, 24> bytes{};
+    if (stream.read(reinterpret_cast<char *>(bytes.data()), bytes.size()) && bytes[0] == 0x89 && bytes[1] == 'P' && bytes[2] == 'N' &&
+        bytes[3] == 'G' && std::memcmp(&bytes[12], "IHDR", 4) == 0)
+    {
+        auto width = (uint32_t(bytes[16]) << 24) | (uint32_t(bytes[17]) << 16) | (uint32_t(bytes[18]) << 8) | bytes[19];
+        auto height = (uint32_t(bytes[20]) << 24) | (uint32_t(bytes[21]) << 16) | (uint32_t(bytes[22]) << 8) | bytes[23];
+        return static_cast<uint64_t>(width) * height;
+    }
+    return fs::file_size(path) / sizeof(uint16_t);
+}
+
+//16bit mono pixels in a continuous Mat
+static cv::Mat loadImage(const fs::path &path)
+{
+    auto image = cv::imread(path.string(), cv::IMREAD_ANYDEPTH);
+    if (image.empty())
+    {
+        throw std::runtime_error("cannot read the image");
+    }
+    if (image.depth() != CV_16U || image.channels() != 1)
+    {
+        throw std::runtime_error("not a 16bit mono image");
+    }
+    return image.isContinuous() ? image : image.clone();
+}
+
+//the pixels, the encoded words and the residual of the prediction
+static size_t encodeFootprint(const uint64_t pixels, const Options &options)
+{
+    auto residual = options.prediction != qoi15::Prediction::None ? pixels : 0;
+    return static_cast<size_t>((pixels + residual + qoi15::MaxEncodedSize(static_cast<size_t>(pixels), options.shift)) * sizeof(uint16_t));
+}
+
+//bytes of the pixels and of the file
+using Traffic = std::pair<uint64_t, uint64_t>;
+
+static Traffic encodeFile(const fs::path &input, const fs::path &output, const Options &options, MemoryBudget &budget)
+{
+    Reservation reservation(budget, encodeFootprint(peekPixels(input), options));
+    auto image = loadImage(input);
+    std::ofstream stream(output, std::ios::binary);
+    if (!stream)
+    {
+        throw std::runtime_error("cannot create " + output.string());
+    }
+    qoi15::FileWriter writer(stream, options.checksum, options.indexRows, options.prediction, options.layout, options.lowBits);
+    auto written = writer.Write(image.ptr<uint16_t>(0), static_cast<uint32_t>(image.cols), static_cast<uint32_t>(image.rows), options.shift);
+    if (!stream.flush())
+    {
+        throw std::runtime_error("cannot write " + output.string());
+    }
+    return {image.total() * sizeof(uint16_t), written};
+}
+
+//the bits below the shift come back when the file has them
+static Traffic decodeFile(const fs::path &input, const fs::path &output, MemoryBudget &budget)
+{
+    std::ifstream stream(input, std::ios::binary);
+    if (!stream)
+    {
+        throw std::runtime_error("cannot open the file");
+    }
+    qoi15::FileReader reader(stream);
+    const auto &header = reader.GetHeader();
+    if (header.IsTemporal())
+    {
+        throw std::runtime_error("temporal frames need their reference frame");
+    }
+    if (header.width > static_cast<uint32_t>(std::numeric_limits<int>::max()) || header.height > static_cast<uint32_t>(std::numeric_limits<int>::max()))
+    {
+        throw std::runtime_error("image is too large");
+    }
+
+    Reservation reservation(budget, static_cast<size_t>((header.pixels + header.words + header.GetLowBitsSize()) * sizeof(uint16_t)));
+    cv::Mat image(static_cast<int>(header.height), static_cast<int>(header.width), CV_16UC1);
+    auto capacity = static_cast<size_t>(header.pixels);
+    if (header.HasLowBits())
+    {
+        reader.ReadExact(image.ptr<uint16_t>(0), capacity);
+    }
+    else
+    {
+        reader.Read(image.ptr<uint16_t>(0), capacity);
+    }
+    if (!cv::imwrite(output.string(), image))
+    {
+        throw std::runtime_error("cannot write " + output.string());
+    }
+    return {header.pixels * sizeof(uint16_t), fs::file_size(input)};
+}
+
+//hidden file next to target with the same extension, which imwrite picks the format from
+static fs::path partialPath(const fs::path &target)
+{
+    return target.parent_path() / ("." + target.stem().string() + ".partial" + target.extension().string());
+}
+
+//creates the empty partial file, a file of the user with that name is neither truncated nor removed later
+static void claimPartial(const fs::path &partial)
+{
+    auto file = std::fopen(partial.string().c_str(), "wbx");
+    if (file == nullptr)
+    {
+        throw std::runtime_error(fs::exists(partial) ? partial.string() + " exists, it may be left from an interrupted run"
+                                                     : "cannot create " + partial.string());
+    }
+    std::fclose(file);
+}
+
+//moves the complete partial file to target, which is only replaced with --overwrite,
+//a hard link fails if target exists, also if it appeared while the file was written
+static void publish(const fs::path &partial, const fs::path &target, const bool overwrite)
+{
+    if (overwrite)
+    {
+        fs::rename(partial, target);
+        return;
+    }
+    std::error_code error;
+    fs::create_hard_link(partial, target, error);
+    if (error == std::errc::file_exists)
+    {
+        throw std::runtime_error(target.string() + " exists, --overwrite replaces it");
+    }
+    if (error)
+    {
+        //file systems without hard links only have the check in front of the rename
+        if (fs::exists(target))
+        {
+            throw std::runtime_error(target.string() + " exists, --overwrite replaces it");
+        }
+        fs::rename(partial, target);
+        return;
+    }
+    fs::remove(partial, error);
+}
+
+//without the prefix the library puts on its messages
+static std::string describe(const std::exception &e)
+{
+    std::string message(e.what());
+    return message.rfind("qoi15: ", 0) == 0 ? message.substr(7) : message;
+}
+
+//encode or decode of a file or of a directory tree on a pool of workers, returns the exit code
+static int convert(const bool encode, const Options &options)
+{
+    if (options.paths.empty() || options.paths.size() > 2)
+    {
+        std::cerr << usage;
+        return 2;
+    }
+    fs::path input = options.paths[0];
+    fs::path output = options.paths.size() > 1 ? fs::path(options.paths[1]) : fs::path();
+    auto extension = encode ? std::string(".qoi15") : "." + options.format;
+
+    //pairs of input and output, a single file keeps the name it is given
+    std::vector<std::pair<fs::path, fs::path>> jobs;
+    if (fs::is_directory(input))
+    {
+        auto root = output.empty() ? input : output;
+        for (const auto &entry : fs::recursive_directory_iterator(input))
+        {
+            if (entry.is_regular_file() && (encode ? isImage(entry.path()) : isEncoded(entry.path())))
+            {
+                auto target = root / fs::relative(entry.path(), input);
+                jobs.emplace_back(entry.path(), target.replace_extension(extension));
+            }
+        }
+        std::sort(jobs.begin(), jobs.end());
+    }
+    else if (fs::is_regular_file(input))
+    {
+        jobs.emplace_back(input, output.empty() ? fs::path(input).replace_extension(extension) : output);
+        if (fs::exists(jobs[0].second) && fs::equivalent(input, jobs[0].second))
+        {
+            std::cerr << "qoi15: " << input.string() << ": output is the input\n";
+            return 1;
+        }
+    }
+    else
+    {
+        std::cerr << "qoi15: " << input.string() << ": no such file or directory\n";
+        return 1;
+    }
+
+    //e.g. a.png and a.tiff would both become a.qoi15
+    std::vector<std::pair<fs::path, fs::path>> targets;
+    for (const auto &job : jobs)
+    {
+        targets.emplace_back(job.second, job.first);
+    }
+    std::sort(targets.begin(), targets.end());
+    for (size_t i = 1; i < targets.size(); i++)
+    {
+        if (targets[i].first == targets[i - 1].first)
+        {
+            std::cerr << "qoi15: " << targets[i - 1].second.string() << " and " << targets[i].second.string() << " both become "
+                      << targets[i].first.string() << "\n";
+            return 1;
+        }
+    }
+
+    MemoryBudget budget(options.memory);
+    qoi15::ThreadPool pool(std::min(options.threads > 0 ? options.threads : static_cast<int>(std::thread::hardware_concurrency()),
+                                    std::max(static_cast<int>(jobs.size()), 1)));
+    std::mutex errorMutex;
+    std::atomic<int> failed(0);
+    std::atomic<uint64_t> pixelBytes(0);
+    std::atomic<uint64_t> fileBytes(0);
+    auto begin = std::chrono::steady_clock::now();
+    pool.Run(static_cast<int>(jobs.size()), [&](const int i)
+             {
+                 const auto &job = jobs[i];
+                 //published once it is complete, a failure only removes the partial file this run created
+                 auto partial = partialPath(job.second);
+                 auto claimed = false;
+                 try
+                 {
+                     if (!options.overwrite && fs::exists(job.second))
+                     {
+                         throw std::runtime_error(job.second.string() + " exists, --overwrite replaces it");
+                     }
+                     if (job.second.has_parent_path())
+                     {
+                         fs::create_directories(job.second.parent_path());
+                     }
+                     claimPartial(partial);
+                     claimed = true;
+                     auto traffic = encode ? encodeFile(job.first, partial, options, budget) : decodeFile(job.first, partial, budget);
+                     publish(partial, job.second, options.overwrite);
+                     pixelBytes += traffic.first;
+                     fileBytes += traffic.second;
+                 }
+                 catch (const std::exception &e)
+                 {
+                     std::error_code ignored;
+                     if (claimed)
+                     {
+                         fs::remove(partial, ignored);
+                     }
+                     failed++;
+                     std::lock_guard<std::mutex> lock(errorMutex);
+                     std::cerr << "qoi15: " << job.first.string() << ": " << describe(e) << "\n";
+                 }
+             });
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    if (jobs.size() > 1)
+    {
+        std::printf("%d of %d files, %.1f MB pixels, %.1f MB files, %.2f s, %.1f MB/s\n", static_cast<int>(jobs.size()) - failed.load(),
+                    static_cast<int>(jobs.size()), pixelBytes / 1e6, fileBytes / 1e6, seconds, pixelBytes / 1e6 / std::max(seconds, 1e-9));
+    }
+    return failed > 0 ? 1 : 0;
+}
+
+//runs function until seconds have passed, at least once, returns the seconds per run
+template <class Function>
+static double measure(const double seconds, Function &&function)
+{
+    auto begin = std::chrono::steady_clock::now();
+    auto runs = 0;
+    double elapsed;
+    do
+    {
+        function();
+        runs++;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    } while (elapsed < seconds);
+    return elapsed / runs;
+}
+
+//one line per image, on one thread, through the same FileWriter and FileReader as encode and decode
+static bool benchImage(const std::string &name, const uint16_t *pixels, const uint32_t width, const uint32_t height, const Options &options)
+{
+    auto size = static_cast<size_t>(width) * height;
+    std::stringstream encoded;
+    qoi15::FileWriter writer(encoded, options.checksum, options.indexRows, options.prediction, options.layout, options.lowBits);
+    size_t written = 0;
+    auto encodeTime = measure(options.seconds, [&]()
+                              {
+                                  encoded.seekp(0);
+                                  written = writer.Write(pixels, width, height, options.shift);
+                              });
+
+    std::stringstream file(encoded.str().substr(0, written));
+    std::vector<uint16_t> decoded(size);
+    auto decodeTime = measure(options.seconds, [&]()
+                              {
+                                  file.clear();
+                                  file.seekg(0);
+                                  qoi15::FileReader reader(file);
+                                  if (reader.GetHeader().HasLowBits())
+                                  {
+                                      reader.ReadExact(decoded.data(), decoded.size());
+                                  }
+                                  else
+                                  {
+                                      reader.Read(decoded.data(), decoded.size());
+                                  }
+                              });
+
+    auto exact = options.shift == qoi15::LosslessShift || options.lowBits;
+    auto mask = static_cast<uint16_t>(exact ? 0xFFFF : 0xFFFF << options.shift);
+    auto matches = true;
+    for (size_t i = 0; i < size; ++i)
+    {
+        matches = matches && decoded[i] == (pixels[i] & mask);
+    }
+
+    auto bytes = size * sizeof(uint16_t);
+    std::printf("%-24s %6ux%-6u %7.3f %10.1f %10.1f%s\n", name.c_str(), width, height, static_cast<double>(written) / bytes,
+                bytes / 1e6 / encodeTime, bytes / 1e6 / decodeTime, matches ? "" : "  MISMATCH");
+    return matches;
+}
+
+static int bench(const Options &options)
+{
+    std::printf("%-24s %13s %7s %10s %10s\n", "image", "size", "ratio", "enc MB/s", "dec MB/s");
+    auto failed = false;
+    if (options.paths.empty())
+    {
+        for (auto kind : qoi15::GetSyntheticKinds())
+        {
+            qoi15::SyntheticImage image(kind, options.size, options.size);
+            auto pixels = image.Generate();
+            failed |= !benchImage(qoi15::GetSyntheticName(kind), pixels.data(), image.GetWidth(), image.GetHeight(), options);
+        }
+        return failed ? 1 : 0;
+    }
+
+    std::vector<fs::path> paths;
+    for (const auto &path : options.paths)
+    {
+        if (fs::is_directory(path))
+        {
+            for (const auto &entry : fs::recursive_directory_iterator(path))
+            {
+                if (entry.is_regular_file() && isImage(entry.path()))
+                {
+                    paths.push_back(entry.path());
+                }
+            }
+        }
+        else
+        {
+            paths.push_back(path);
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+    for (const auto &path : paths)
+    {
+        try
+        {
+            auto image = loadImage(path);
+            failed |= !benchImage(path.filename().string(), image.ptr<uint16_t>(0), static_cast<uint32_t>(image.cols), static_cast<uint32_t>(image.rows), options);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "qoi15: " << path.string() << ": " << describe(e) << "\n";
+            failed = true;
+        }
+    }
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << usage;
+        return 2;
+    }
+    std::string command(argv[1]);
+    Options options;
+    try
+    {
+        options = parseOptions(std::vector<std::string>(argv + 2, argv + argc));
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "qoi15: " << e.what() << "\n" << usage;
+        return 2;
+    }
+
+    try
+    {
+        if (command == "encode" || command == "decode")
+        {
+            return convert(command == "encode", options);
+        }
+        if (command == "bench")
+        {
+            return bench(options);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "qoi15: " << describe(e) << "\n";
+        return 1;
+    }
+    std::cerr << usage;
+    return command == "help" || command == "--help" ? 0 : 2;
+}